@@ -19,6 +19,12 @@
 #define SPRITE_ALIVE      1
 #define SPRITE_DYING      2
 
+#define MAX_BATCH_SPRITES 4096 // draw requests a sprite batch can hold, a power of two up to 4096
+#define MAX_BATCH_LAYERS  256  // layers of a sprite batch, 0 is drawn first
+#define BATCH_TILE_HEIGHT 32   // screen rows a sprite batch draws per pass
+#define BATCH_TILES       ((SCREEN_HEIGHT + BATCH_TILE_HEIGHT - 1) / BATCH_TILE_HEIGHT)
+#define BATCH_TILE_SPAN   ((SPRITE_HEIGHT + BATCH_TILE_HEIGHT - 2) / BATCH_TILE_HEIGHT + 1) // most tiles one sprite can touch
+
 // S T R U C T U R E S ///////////////////////////////////////////////////////
 
 // this structure holds a RGB triple in three bytes
@@ -53,6 +59,9 @@ typedef struct pcx_picture_typ
 	unsigned char *buffer;
 } pcx_picture, *pcx_picture_ptr;
 
+// a blitter compiled for one frame size and destination, see Blit_Sprite_Frame
+typedef void (*sprite_blitter)(unsigned char *dest, const unsigned char *src);
+
 typedef struct sprite_typ
 {
 	int x, y;            // position of sprite
@@ -68,8 +77,30 @@ typedef struct sprite_typ
 	int num_frames;                      // total number of frames
 	int state;                           // state of sprite, alive, dead...
 	unsigned char *background;                // whats under the sprite
+	unsigned char *spans[MAX_SPRITE_FRAMES];  // run length encoded frames, see Sprite_Encode
+	sprite_blitter blitters[MAX_SPRITE_FRAMES]; // blitter picked for every frame when it was grabbed
 } sprite, *sprite_ptr;
 
+typedef struct sprite_batch_item_typ
+{
+	unsigned char *frame;     // image of the sprite
+	unsigned char *spans;     // run length encoded copy of the image, if any
+	sprite_blitter blitter;   // blitter picked for the image, if any
+	int x, y;                 // screen position of the top left corner
+	int left, top;            // part of the image that is on the screen
+	int right, bottom;
+} sprite_batch_item, *sprite_batch_item_ptr;
+
+typedef struct sprite_batch_typ
+{
+	sprite_batch_item items[MAX_BATCH_SPRITES];           // in the order they were added
+	unsigned long long keys[MAX_BATCH_SPRITES];           // layer, y, x and index of every item
+	unsigned long long sorted[MAX_BATCH_SPRITES];         // the keys in drawing order
+	int count;
+	int tile_first[BATCH_TILES + 1];                      // where the list of each tile starts in tile_items
+	int tile_items[MAX_BATCH_SPRITES * BATCH_TILE_SPAN];  // the items touching each tile, in drawing order
+} sprite_batch, *sprite_batch_ptr;
+
 // RECT structure (windef.h)
 typedef struct RECT_TYP {
 	int left;
@@ -92,6 +123,9 @@ void Blit_Char(int xc, int yc, char c, int color, int trans_flag)
 	// compute offset of character in video buffer
 	int offset = (yc * SCREEN_WIDTH) + xc;
 
+	// tell the flip engine which part of the screen is changing
+	RETRO_Damage(xc, yc, xc + CHAR_WIDTH, yc + CHAR_HEIGHT);
+
 	for (int y = 0; y < CHAR_HEIGHT; y++) {
 		// reset bit mask
 		unsigned char bit_mask = 0x01;
@@ -172,6 +206,7 @@ void Plot_Pixel_Fast(int x, int y, unsigned char color)
 
 	// use the fact that 320*y = 256*y + 64*y = y<<8 + y<<6
 	RETRO.framebuffer[(y * SCREEN_WIDTH) + x] = color;
+	RETRO_Damage(x, y, x + 1, y + 1);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -274,6 +309,91 @@ void PCX_Show_Buffer(pcx_picture_ptr image)
 	// just copy he pcx buffer into the video buffer
 
 	memcpy(RETRO.framebuffer, image->buffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+	RETRO_DamageAll();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned long long Sprite_Opaque_Mask(unsigned long long pixels)
+{
+	// this function returns 0xff for every byte of pixels that is not 0, using
+	// arithmetic instead of a test per pixel.  the high bit of each byte is set
+	// if any of its bits are and then widened to the whole byte
+
+	unsigned long long high = (((pixels & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | pixels) & 0x8080808080808080ULL;
+	return (high >> 7) * 0xff;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void Blit_Sprite_Row(unsigned char *dest, const unsigned char *src, int count)
+{
+	// this function copies the non zero pixels of a row of any length, 8 at a
+	// time with the same mask as Blit_Sprite_Frame
+
+	int x = 0;
+
+	for (; x + 8 <= count; x += 8) {
+		unsigned long long pixels, under;
+		memcpy(&pixels, &src[x], 8);
+		memcpy(&under, &dest[x], 8);
+		unsigned long long mask = Sprite_Opaque_Mask(pixels);
+		pixels = (pixels & mask) | (under & ~mask);
+		memcpy(&dest[x], &pixels, 8);
+	}
+
+	for (; x < count; x++) {
+		if (src[x]) {
+			dest[x] = src[x];
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+template <int width, int height, int src_pitch, int dest_pitch, bool transparent>
+void Blit_Sprite_Frame(unsigned char *dest, const unsigned char *src)
+{
+	// this function copies a block whose size and pitches are known when it is
+	// compiled, so every row turns into a fixed run of 8 byte moves.  pixels
+	// that are 0 in a transparent block keep what is under them
+
+	static_assert(width % 8 == 0, "rows are copied 8 bytes at a time");
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x += 8) {
+			unsigned long long pixels;
+			memcpy(&pixels, &src[x], 8);
+
+			if (transparent) {
+				unsigned long long under;
+				memcpy(&under, &dest[x], 8);
+
+				unsigned long long mask = Sprite_Opaque_Mask(pixels);
+				pixels = (pixels & mask) | (under & ~mask);
+			}
+
+			memcpy(&dest[x], &pixels, 8);
+		}
+
+		// move to next line in both buffers
+		src += src_pitch;
+		dest += dest_pitch;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+sprite_blitter Sprite_Select_Blitter(unsigned char *frame)
+{
+	// this function picks the blitter for a frame, a frame without transparent
+	// pixels can be copied without looking at them
+
+	if (memchr(frame, 0, SPRITE_WIDTH * SPRITE_HEIGHT)) {
+		return Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, true>;
+	}
+
+	return Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, false>;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -300,6 +420,8 @@ void Sprite_Init(sprite_ptr sprite, int x, int y, int ac, int as, int mc, int ms
 	// set all bitmap pointers to null
 	for (int index = 0; index < MAX_SPRITE_FRAMES; index++) {
 		sprite->frames[index] = NULL;
+		sprite->spans[index] = NULL;
+		sprite->blitters[index] = NULL;
 	}
 }
 
@@ -314,6 +436,7 @@ void Sprite_Delete(sprite_ptr sprite)
 	// now de-allocate all the animation frames
 	for (int index = 0; index < MAX_SPRITE_FRAMES; index++) {
 		free(sprite->frames[index]);
+		free(sprite->spans[index]);
 	}
 }
 
@@ -355,92 +478,215 @@ void PCX_Grap_Bitmap(pcx_picture_ptr image,
 		y_off += 320;
 	}
 
+	// pick the blitter now that the frame is known
+	sprite->blitters[sprite_frame] = Sprite_Select_Blitter(sprite_data);
+
 	// increment number of frames
 	sprite->num_frames++;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-void Behind_Sprite(sprite_ptr sprite)
+unsigned char *Sprite_Encode_Frame(unsigned char *data)
 {
-	// this function scans the background behind a sprite so that when the sprite
-	// is draw, the background isnn'y obliterated
+	// this function run length encodes a frame so that it can be drawn without
+	// looking at the transparent pixels.  the encoded frame starts with the
+	// offset of every row as an unsigned short, and each row holds the number
+	// of runs followed by a skip count, a length and the opaque pixels of
+	// every run
+
+	unsigned char row[1 + SPRITE_WIDTH * 3];
+	unsigned char *spans = (unsigned char *)malloc(SPRITE_HEIGHT * sizeof(unsigned short) + SPRITE_HEIGHT * sizeof(row));
+	unsigned short *offsets = (unsigned short *)spans;
+	int size = SPRITE_HEIGHT * sizeof(unsigned short);
+
+	for (int y = 0; y < SPRITE_HEIGHT; y++) {
+		unsigned char *pixels = &data[y * SPRITE_WIDTH];
+		int length = 1, x = 0;
+
+		row[0] = 0;
+
+		while (x < SPRITE_WIDTH) {
+			// count the transparent pixels and then the opaque ones after them
+			int skip = x;
+			while (x < SPRITE_WIDTH && pixels[x] == 0) {
+				x++;
+			}
+			int start = x;
+			while (x < SPRITE_WIDTH && pixels[x] != 0) {
+				x++;
+			}
+			if (x == start) {
+				break;
+			}
 
-	unsigned char *work_back;
-	int work_offset = 0, offset, y;
+			row[0]++;
+			row[length++] = start - skip;
+			row[length++] = x - start;
+			memcpy(&row[length], &pixels[start], x - start);
+			length += x - start;
+		}
+
+		offsets[y] = size;
+		memcpy(&spans[size], row, length);
+		size += length;
+	}
 
-	// alias a pointer to sprite background for ease of access
-	work_back = sprite->background;
+	return (unsigned char *)realloc(spans, size);
+}
 
-	// compute offset of background in video buffer
-	offset = (sprite->y << 8) + (sprite->y << 6) + sprite->x;
+//////////////////////////////////////////////////////////////////////////////
 
-	for (y = 0; y < SPRITE_HEIGHT; y++) {
-		// copy the next row out off screen buffer into sprite background buffer
-		memcpy(&work_back[work_offset], &RETRO.framebuffer[offset], SPRITE_WIDTH);
+void Sprite_Encode(sprite_ptr sprite)
+{
+	// this function builds the run length encoded copy of every frame, call it
+	// once the frames are loaded and Draw_Sprite will use the runs from then on
 
-		// move to next line in video buffer and in sprite background buffer
-		offset += SCREEN_WIDTH;
-		work_offset += SPRITE_WIDTH;
+	for (int index = 0; index < MAX_SPRITE_FRAMES; index++) {
+		free(sprite->spans[index]);
+		sprite->spans[index] = sprite->frames[index] ? Sprite_Encode_Frame(sprite->frames[index]) : NULL;
 	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
+void Sprite_Transpose(sprite_ptr sprite)
+{
+	// this function mirrors every frame of a sprite about its diagonal, so
+	// that each column of the image is stored as a row.  the wall renderers
+	// draw one vertical sliver at a time, and this way a sliver reads
+	// contiguous bytes instead of one byte every SPRITE_WIDTH
+
+	for (int index = 0; index < MAX_SPRITE_FRAMES; index++) {
+		unsigned char *data = sprite->frames[index];
+		if (data == NULL) {
+			continue;
+		}
+
+		for (int y = 0; y < SPRITE_HEIGHT; y++) {
+			for (int x = y + 1; x < SPRITE_WIDTH; x++) {
+				unsigned char pixel = data[y * SPRITE_WIDTH + x];
+				data[y * SPRITE_WIDTH + x] = data[x * SPRITE_WIDTH + y];
+				data[x * SPRITE_WIDTH + y] = pixel;
+			}
+		}
+
+		// keep an encoded copy of the frame in step with the new layout
+		if (sprite->spans[index]) {
+			free(sprite->spans[index]);
+			sprite->spans[index] = Sprite_Encode_Frame(data);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void Behind_Sprite(sprite_ptr sprite)
+{
+	// this function scans the background behind a sprite so that when the sprite
+	// is draw, the background isnn'y obliterated
+
+	unsigned char *work_back = sprite->background;
+	unsigned char *screen = &RETRO.framebuffer[sprite->y * SCREEN_WIDTH + sprite->x];
+
+	Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SCREEN_WIDTH, SPRITE_WIDTH, false>(work_back, screen);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 void Erase_Sprite(sprite_ptr sprite)
 {
 	// this function replaces the background that was saved from where a sprite
 	// was going to be placed
 
-	unsigned char *work_back;
-	int work_offset = 0, offset, y;
+	unsigned char *work_back = sprite->background;
+	unsigned char *screen = &RETRO.framebuffer[sprite->y * SCREEN_WIDTH + sprite->x];
 
-	// alias a pointer to sprite background for ease of access
-	work_back = sprite->background;
+	// tell the flip engine which part of the screen is changing
+	RETRO_Damage(sprite->x, sprite->y, sprite->x + SPRITE_WIDTH, sprite->y + SPRITE_HEIGHT);
 
-	// compute offset of background in video buffer
-	offset = (sprite->y << 8) + (sprite->y << 6) + sprite->x;
+	Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, false>(screen, work_back);
+}
 
-	for (y = 0; y < SPRITE_HEIGHT; y++) {
-		// copy the next row out off screen buffer into sprite background buffer
-		memcpy(&RETRO.framebuffer[offset], &work_back[work_offset], SPRITE_WIDTH);
+//////////////////////////////////////////////////////////////////////////////
 
-		// move to next line in video buffer and in sprite background buffer
-		offset += SCREEN_WIDTH;
-		work_offset += SPRITE_WIDTH;
+void Draw_Spans_Row(unsigned char *dest, unsigned char *run, int left, int right)
+{
+	// this function copies the runs of one encoded row to dest, which is where
+	// the first pixel of the row goes, keeping only columns left to right - 1
+
+	int runs = *run++, x = 0;
+
+	while (runs-- > 0) {
+		int length = run[1];
+		x += run[0];
+
+		// the part of the run between the left and right edge
+		int first = SDL_max(x, left);
+		int last = SDL_min(x + length, right);
+		if (first < last) {
+			memcpy(&dest[first], &run[2 + first - x], last - first);
+		}
+
+		x += length;
+		run += 2 + length;
 	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-void Draw_Sprite(sprite_ptr sprite)
+void Draw_Sprite_Spans(sprite_ptr sprite)
 {
-	// this function draws a sprite on the screen row by row very quickly
-	// note the use of shifting to implement multplication
+	// this function draws the run length encoded copy of the current frame.
+	// the transparent pixels are skipped in one step and every opaque run is
+	// copied with memcpy, clipped against the edges of the screen
 
-	unsigned char *work_sprite;
-	int work_offset = 0, offset, x, y;
-	unsigned char data;
+	unsigned char *spans = sprite->spans[sprite->curr_frame];
+	unsigned short *offsets = (unsigned short *)spans;
 
-	// alias a pointer to sprite for ease of access
-	work_sprite = sprite->frames[sprite->curr_frame];
+	// rows and columns of the frame that are on the screen
+	int top = SDL_max(0, -sprite->y);
+	int bottom = SDL_min(SPRITE_HEIGHT, SCREEN_HEIGHT - sprite->y);
+	int left = SDL_max(0, -sprite->x);
+	int right = SDL_min(SPRITE_WIDTH, SCREEN_WIDTH - sprite->x);
 
-	// compute offset of sprite in video buffer
-	offset = (sprite->y << 8) + (sprite->y << 6) + sprite->x;
+	if (top >= bottom || left >= right) {
+		return;
+	}
 
-	for (y = 0; y < SPRITE_HEIGHT; y++) {
-		// copy the next row into the screen buffer using memcpy for speed
-		for (x = 0; x < SPRITE_WIDTH; x++) {
-			// test for transparent pixel i.e. 0, if not transparent then draw
-			if ((data = work_sprite[work_offset + x])) {
-				RETRO.framebuffer[offset + x] = data;
-			}
-		}
+	// tell the flip engine which part of the screen is changing
+	RETRO_Damage(sprite->x + left, sprite->y + top, sprite->x + right, sprite->y + bottom);
 
-		// move to next line in video buffer and in sprite bitmap buffer
-		offset += SCREEN_WIDTH;
-		work_offset += SPRITE_WIDTH;
+	unsigned char *dest = &RETRO.framebuffer[(sprite->y + top) * SCREEN_WIDTH + sprite->x];
+
+	for (int y = top; y < bottom; y++) {
+		Draw_Spans_Row(dest, &spans[offsets[y]], left, right);
+		dest += SCREEN_WIDTH;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void Draw_Sprite(sprite_ptr sprite)
+{
+	// this function draws a sprite on the screen with the blitter that was
+	// compiled for its frame
+
+	// encoded frames skip their transparent pixels and clip themselves
+	if (sprite->spans[sprite->curr_frame]) {
+		Draw_Sprite_Spans(sprite);
+		return;
+	}
+
+	sprite_blitter blitter = sprite->blitters[sprite->curr_frame];
+	if (blitter == NULL) {
+		blitter = Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, true>;
 	}
+
+	// tell the flip engine which part of the screen is changing
+	RETRO_Damage(sprite->x, sprite->y, sprite->x + SPRITE_WIDTH, sprite->y + SPRITE_HEIGHT);
+
+	blitter(&RETRO.framebuffer[sprite->y * SCREEN_WIDTH + sprite->x], sprite->frames[sprite->curr_frame]);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -450,80 +696,213 @@ void Behind_Sprite_VB(sprite_ptr sprite)
 	// this function scans the background behind a sprite so that when the sprite
 	// is draw, the background isnn'y obliterated
 
-	unsigned char *work_back;
-	int work_offset = 0, offset, y;
+	unsigned char *work_back = sprite->background;
+	unsigned char *screen = &RETRO.framebuffer[sprite->y * SCREEN_WIDTH + sprite->x];
 
-	// alias a pointer to sprite background for ease of access
-	work_back = sprite->background;
+	Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SCREEN_WIDTH, SPRITE_WIDTH, false>(work_back, screen);
+}
 
-	// compute offset of background in video buffer
-	offset = (sprite->y << 8) + (sprite->y << 6) + sprite->x;
+//////////////////////////////////////////////////////////////////////////////
 
-	for (y = 0; y < SPRITE_HEIGHT; y++) {
-		// copy the next row out off screen buffer into sprite background buffer
-		memcpy(&work_back[work_offset], &RETRO.framebuffer[offset], SPRITE_WIDTH);
+void Erase_Sprite_VB(sprite_ptr sprite)
+{
+	// this function replaces the background that was saved from where a sprite
+	// was going to be placed
 
-		// move to next line in video buffer and in sprite background buffer
-		offset += SCREEN_WIDTH;
-		work_offset += SPRITE_WIDTH;
+	unsigned char *work_back = sprite->background;
+	unsigned char *screen = &RETRO.framebuffer[sprite->y * SCREEN_WIDTH + sprite->x];
+
+	// tell the flip engine which part of the screen is changing
+	RETRO_Damage(sprite->x, sprite->y, sprite->x + SPRITE_WIDTH, sprite->y + SPRITE_HEIGHT);
+
+	Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, false>(screen, work_back);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void Draw_Sprite_VB(sprite_ptr sprite)
+{
+	// this function draws a sprite on the screen with the blitter that was
+	// compiled for its frame
+
+	// encoded frames skip their transparent pixels and clip themselves
+	if (sprite->spans[sprite->curr_frame]) {
+		Draw_Sprite_Spans(sprite);
+		return;
+	}
+
+	sprite_blitter blitter = sprite->blitters[sprite->curr_frame];
+	if (blitter == NULL) {
+		blitter = Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, true>;
 	}
+
+	// tell the flip engine which part of the screen is changing
+	RETRO_Damage(sprite->x, sprite->y, sprite->x + SPRITE_WIDTH, sprite->y + SPRITE_HEIGHT);
+
+	blitter(&RETRO.framebuffer[sprite->y * SCREEN_WIDTH + sprite->x], sprite->frames[sprite->curr_frame]);
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-void Erase_Sprite_VB(sprite_ptr sprite)
+void Sprite_Batch_Begin(sprite_batch_ptr batch)
 {
-	// this function replaces the background that was saved from where a sprite
-	// was going to be placed
+	// this function empties a batch before the draw requests of a new frame
 
-	unsigned char *work_back;
-	int work_offset = 0, offset, y;
+	batch->count = 0;
+}
 
-	// alias a pointer to sprite background for ease of access
-	work_back = sprite->background;
+//////////////////////////////////////////////////////////////////////////////
 
-	// compute offset of background in video buffer
-	offset = (sprite->y << 8) + (sprite->y << 6) + sprite->x;
+void Sprite_Batch_Add(sprite_batch_ptr batch, sprite_ptr sprite, int layer)
+{
+	// this function records a request to draw the current frame of a sprite on
+	// a layer from 0 to MAX_BATCH_LAYERS - 1.  the sprite is clipped here, once,
+	// and requests that are off the screen or do not fit in the batch are dropped
 
-	for (y = 0; y < SPRITE_HEIGHT; y++) {
-		// copy the next row out off screen buffer into sprite background buffer
-		memcpy(&RETRO.framebuffer[offset], &work_back[work_offset], SPRITE_WIDTH);
+	int left = SDL_max(0, -sprite->x);
+	int top = SDL_max(0, -sprite->y);
+	int right = SDL_min(SPRITE_WIDTH, SCREEN_WIDTH - sprite->x);
+	int bottom = SDL_min(SPRITE_HEIGHT, SCREEN_HEIGHT - sprite->y);
 
-		// move to next line in video buffer and in sprite background buffer
-		offset += SCREEN_WIDTH;
-		work_offset += SPRITE_WIDTH;
+	if (left >= right || top >= bottom || batch->count == MAX_BATCH_SPRITES) {
+		return;
 	}
+
+	sprite_batch_item_ptr item = &batch->items[batch->count];
+	item->frame = sprite->frames[sprite->curr_frame];
+	item->spans = sprite->spans[sprite->curr_frame];
+	item->blitter = sprite->blitters[sprite->curr_frame];
+	item->x = sprite->x;
+	item->y = sprite->y;
+	item->left = left;
+	item->top = top;
+	item->right = right;
+	item->bottom = bottom;
+
+	// the drawing order packed in one number, layers from the bottom up, then
+	// top to bottom and left to right on the screen, ties in request order
+	layer = SDL_min(SDL_max(layer, 0), MAX_BATCH_LAYERS - 1);
+	batch->keys[batch->count] = (unsigned long long)layer << 36 | (unsigned long long)(sprite->y + SPRITE_HEIGHT) << 24 |
+								(unsigned long long)(sprite->x + SPRITE_WIDTH) << 12 | batch->count;
+	batch->count++;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-void Draw_Sprite_VB(sprite_ptr sprite)
+void Sprite_Batch_Sort(sprite_batch_ptr batch)
 {
-	// this function draws a sprite on the screen row by row very quickly
-	// note the use of shifting to implement multplication
+	// this function radix sorts the keys of a batch into drawing order, eight
+	// bits at a time over the 44 bits that are in use
 
-	unsigned char *work_sprite;
-	int work_offset = 0, offset, x, y;
-	unsigned char data;
+	unsigned long long *from = batch->keys, *to = batch->sorted;
 
-	// alias a pointer to sprite for ease of access
-	work_sprite = sprite->frames[sprite->curr_frame];
+	for (int shift = 0; shift < 48; shift += 8) {
+		int start[257] = { 0 };
 
-	// compute offset of sprite in video buffer
-	offset = (sprite->y << 8) + (sprite->y << 6) + sprite->x;
+		for (int index = 0; index < batch->count; index++) {
+			start[((from[index] >> shift) & 255) + 1]++;
+		}
+		for (int digit = 0; digit < 256; digit++) {
+			start[digit + 1] += start[digit];
+		}
+		for (int index = 0; index < batch->count; index++) {
+			to[start[(from[index] >> shift) & 255]++] = from[index];
+		}
 
-	for (y = 0; y < SPRITE_HEIGHT; y++) {
-		// copy the next row into the screen buffer using memcpy for speed
-		for (x = 0; x < SPRITE_WIDTH; x++) {
-			// test for transparent pixel i.e. 0, if not transparent then draw
-			if ((data = work_sprite[work_offset + x])) {
-				RETRO.framebuffer[offset + x] = data;
+		unsigned long long *swap = from;
+		from = to;
+		to = swap;
+	}
+
+	// six passes leave the result where it started
+	memcpy(batch->sorted, batch->keys, batch->count * sizeof(unsigned long long));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void Sprite_Batch_Draw(sprite_batch_ptr batch)
+{
+	// this function sorts the requests and draws them a band of
+	// BATCH_TILE_HEIGHT screen rows at a time, so every sprite touching a band
+	// writes into it while it is still in the cache.  frames are drawn from
+	// their runs when they are encoded, copied when they are opaque and masked
+	// otherwise
+
+	sprite_batch_item_ptr items = batch->items;
+	int *first = batch->tile_first;
+
+	Sprite_Batch_Sort(batch);
+
+	// count the items of each tile and turn the counts into list positions
+	memset(first, 0, sizeof(batch->tile_first));
+
+	for (int index = 0; index < batch->count; index++) {
+		sprite_batch_item_ptr item = &items[index];
+		for (int tile = (item->y + item->top) / BATCH_TILE_HEIGHT; tile <= (item->y + item->bottom - 1) / BATCH_TILE_HEIGHT; tile++) {
+			first[tile + 1]++;
+		}
+	}
+
+	for (int tile = 0; tile < BATCH_TILES; tile++) {
+		first[tile + 1] += first[tile];
+	}
+
+	int next[BATCH_TILES];
+	memcpy(next, first, sizeof(next));
+
+	for (int order = 0; order < batch->count; order++) {
+		int index = batch->sorted[order] & (MAX_BATCH_SPRITES - 1);
+		sprite_batch_item_ptr item = &items[index];
+		for (int tile = (item->y + item->top) / BATCH_TILE_HEIGHT; tile <= (item->y + item->bottom - 1) / BATCH_TILE_HEIGHT; tile++) {
+			batch->tile_items[next[tile]++] = index;
+		}
+	}
+
+	for (int tile = 0; tile < BATCH_TILES; tile++) {
+		int tile_top = tile * BATCH_TILE_HEIGHT;
+		int tile_bottom = SDL_min(tile_top + BATCH_TILE_HEIGHT, SCREEN_HEIGHT);
+		int damage_left = SCREEN_WIDTH, damage_right = 0;
+		int damage_top = tile_bottom, damage_bottom = tile_top;
+
+		for (int entry = first[tile]; entry < first[tile + 1]; entry++) {
+			sprite_batch_item_ptr item = &items[batch->tile_items[entry]];
+
+			// the rows of the image inside this tile
+			int top = SDL_max(item->top, tile_top - item->y);
+			int bottom = SDL_min(item->bottom, tile_bottom - item->y);
+			int width = item->right - item->left;
+			unsigned char *dest = &RETRO.framebuffer[(item->y + top) * SCREEN_WIDTH + item->x];
+
+			damage_left = SDL_min(damage_left, item->x + item->left);
+			damage_right = SDL_max(damage_right, item->x + item->right);
+			damage_top = SDL_min(damage_top, item->y + top);
+			damage_bottom = SDL_max(damage_bottom, item->y + bottom);
+
+			if (item->spans) {
+				unsigned short *offsets = (unsigned short *)item->spans;
+				for (int y = top; y < bottom; y++) {
+					Draw_Spans_Row(dest, &item->spans[offsets[y]], item->left, item->right);
+					dest += SCREEN_WIDTH;
+				}
+			} else {
+				unsigned char *src = &item->frame[top * SPRITE_WIDTH + item->left];
+				int opaque = item->blitter == Blit_Sprite_Frame<SPRITE_WIDTH, SPRITE_HEIGHT, SPRITE_WIDTH, SCREEN_WIDTH, false>;
+
+				dest += item->left;
+				for (int y = top; y < bottom; y++) {
+					if (opaque) {
+						memcpy(dest, src, width);
+					} else {
+						Blit_Sprite_Row(dest, src, width);
+					}
+					dest += SCREEN_WIDTH;
+					src += SPRITE_WIDTH;
+				}
 			}
 		}
 
-		// move to next line in video buffer and in sprite bitmap buffer
-		offset += SCREEN_WIDTH;
-		work_offset += SPRITE_WIDTH;
+		// tell the flip engine which part of the tile changed, in one piece
+		RETRO_Damage(damage_left, damage_top, damage_right, damage_bottom);
 	}
 }
 
@@ -531,26 +910,66 @@ void Draw_Sprite_VB(sprite_ptr sprite)
 
 void Blit_Rect(RECT src_rect, unsigned char *src_buf, int src_pitch, RECT dest_rect, unsigned char *dest_buf, int dest_pitch, int alpha = -1)
 {
-	unsigned char *src = src_buf;
-	unsigned char *dest = dest_buf;
+	// this function scales src_rect of src_buf onto dest_rect of dest_buf, the
+	// pixels of color alpha are skipped unless alpha is -1.  the destination is
+	// clipped to the screen once, and the source column of every destination
+	// column and the source row of every destination row are looked up before
+	// the copy, with the same float math as always so the pixels do not change
 
 	float dest_xdiff = (dest_rect.right - dest_rect.left) != 0 ? dest_rect.right - dest_rect.left : 1;
 	float dest_ydiff = (dest_rect.bottom - dest_rect.top) != 0 ? dest_rect.bottom - dest_rect.top : 1;
 	float src_xdelta = (src_rect.right - src_rect.left) / dest_xdiff;
 	float src_ydelta = (src_rect.bottom - src_rect.top) / dest_ydiff;
 
-	for (int y = 0; y < dest_ydiff; y++) {
-		for (int x = 0; x < dest_xdiff; x++) {
-			int src_x = src_rect.left + src_xdelta * x;
-			int src_y = src_rect.top + src_ydelta * y;
-			int dest_x = dest_rect.left + x;
-			int dest_y = dest_rect.top + y;
-			if (dest_x >= 0 && dest_x < SCREEN_WIDTH && dest_y >= 0 && dest_y < SCREEN_HEIGHT) {
-				if (alpha == -1 || src[src_y * src_pitch + src_x] != alpha) {
-					dest[dest_y * dest_pitch + dest_x] = src[src_y * src_pitch + src_x];
+	if (dest_buf == RETRO.framebuffer) {
+		RETRO_Damage(dest_rect.left, dest_rect.top, dest_rect.left + dest_xdiff, dest_rect.top + dest_ydiff);
+	}
+
+	// the steps x and y of the rectangle that land on the screen
+	int x1 = SDL_max(0, -dest_rect.left);
+	int y1 = SDL_max(0, -dest_rect.top);
+	int x2 = SDL_min((int)ceilf(dest_xdiff), SCREEN_WIDTH - dest_rect.left);
+	int y2 = SDL_min((int)ceilf(dest_ydiff), SCREEN_HEIGHT - dest_rect.top);
+
+	if (x1 >= x2 || y1 >= y2) {
+		return;
+	}
+
+	int columns[SCREEN_WIDTH];
+	for (int x = x1; x < x2; x++) {
+		columns[x - x1] = src_rect.left + src_xdelta * x;
+	}
+
+	int width = x2 - x1;
+	unsigned char *dest = &dest_buf[(dest_rect.top + y1) * dest_pitch + dest_rect.left + x1];
+	unsigned char *last = NULL;
+	int last_y = 0;
+
+	for (int y = y1; y < y2; y++) {
+		int src_y = src_rect.top + src_ydelta * y;
+		unsigned char *src = &src_buf[src_y * src_pitch];
+
+		if (alpha == -1) {
+			// rows that repeat a source row are a copy of the row before
+			if (last && src_y == last_y && src_buf != dest_buf) {
+				memcpy(dest, last, width);
+			} else {
+				for (int x = 0; x < width; x++) {
+					dest[x] = src[columns[x]];
+				}
+			}
+		} else {
+			for (int x = 0; x < width; x++) {
+				unsigned char data = src[columns[x]];
+				if (data != alpha) {
+					dest[x] = data;
 				}
 			}
 		}
+
+		last = dest;
+		last_y = src_y;
+		dest += dest_pitch;
 	}
 }
 
@@ -14,6 +14,10 @@
 #include <math.h> // cos, sin, pow
 #include <stdio.h> // FILE
 #include <time.h> // time
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SSE2, AVX2
+#define RETRO_X86 1
+#endif
 
 // *******************************************************************
 // Public dynamic functions
@@ -22,8 +26,10 @@
 void __attribute__((weak)) DEMO_Startup(void);
 void __attribute__((weak)) DEMO_Initialize(void);
 void __attribute__((weak)) DEMO_Deinitialize(void);
+void __attribute__((weak)) DEMO_Update(void);
 void __attribute__((weak)) DEMO_Render(double deltatime);
 void __attribute__((weak)) DEMO_Render2(double deltatime);
+void __attribute__((weak)) DEMO_Benchmark(void);
 
 // *******************************************************************
 // Private dynamic functions
@@ -31,6 +37,10 @@ void __attribute__((weak)) DEMO_Render2(double deltatime);
 
 void __attribute__((weak)) RETRO_Initialize_3D(void);
 void __attribute__((weak)) RETRO_Deinitialize_3D(void);
+void __attribute__((weak)) RETRO_Deinitialize_Threads(void);
+void __attribute__((weak)) RETRO_Benchmarks_Gfx(void);
+void __attribute__((weak)) RETRO_ParallelFor(int count, int grain, void (*func)(int index, void *data), void *data);
+void __attribute__((weak)) RETRO_PutString(const char *str, int x, int y, unsigned char color);
 
 // *******************************************************************
 // Public variables
@@ -78,6 +88,34 @@ struct RETRO_Image {
 // *******************************************************************
 
 enum { RETRO_MODE_FULLSCREEN, RETRO_MODE_FULLWINDOW, RETRO_MODE_WINDOW };
+enum { RETRO_STAGE_FRAME, RETRO_STAGE_RENDER, RETRO_STAGE_UPLOAD, RETRO_STAGE_PRESENT, RETRO_STAGES };
+
+#define RETRO_TIMESTEP (1.0 / 60) // Seconds simulated by one DEMO_Update, and by a timedemo frame
+#define RETRO_MAX_STEPS 8 // Updates per frame before a slow machine lets the simulation slow down
+#define RETRO_MAX_ZONES (1 << 20) // Profiler events kept, later ones are dropped
+#define RETRO_FRAMETIMES 1024 // Frame times kept for the percentiles
+#define RETRO_HISTOGRAM 10 // Octaves of the frame time histogram, the first ends at 0.25 ms
+
+typedef void (*RETRO_ExpandFunc)(unsigned int *dest, const unsigned char *src, int count, const unsigned int *palette);
+
+struct RETRO_ZoneEvent {
+	const char *name;
+	unsigned long int start, stop;
+	SDL_threadID thread;
+};
+
+struct RETRO_FrameStats {
+	int frames; // Frame times the statistics are based on
+	float p50, p95, p99, max; // Milliseconds
+	int histogram[RETRO_HISTOGRAM];
+};
+
+struct RETRO_DirtyRows {
+	bool full; // Every row is dirty from edge to edge, nothing more to record
+	int top, bottom;
+	short left[RETRO_HEIGHT];
+	short right[RETRO_HEIGHT];
+};
 
 struct {
 	int mode;
@@ -86,18 +124,63 @@ struct {
 	bool linear;
 	bool showcursor;
 	bool showfps;
-	int fpscap;
+	bool autoclear; // RETRO_Clear before every DEMO_Render, off keeps the last frame to draw over
+	double fpscap; // Frames per second, need not be a whole number
+	bool benchmark;
+	bool pipeline;
+	bool headless;
+	char *dumpframes;
+	int maxframes;
+	int frames;
+	int threads;
+	bool timedemo;
+	double alpha; // Fraction of a step the rendered frame lies past the last DEMO_Update
+	bool quit;
+	float *stagetime[RETRO_STAGES]; // Milliseconds spent in each stage of every timedemo frame
+	int timedframes;
+	double deadline; // Performance counter the paced frame waits for, 0 restarts the schedule
+	int pacedframes;
+	int missedframes; // Paced frames that were done after their deadline
+	double pacingerror; // Milliseconds between deadlines and the wake ups that follow them
+	double maxpacingerror;
+	int timedcapacity;
+	bool showtimes;
+	char *frametimes;
+	float frametime[RETRO_FRAMETIMES]; // Ring buffer of the milliseconds between presents
+	int frametimecount;
+	unsigned long int lastframe; // Performance counter at the end of the last frame, 0 after a pause
+	RETRO_FrameStats framestats;
+	char *profile;
+	RETRO_ZoneEvent *zones;
+	int zonecount;
+	int zonecapacity;
+	int zonesdropped;
+	unsigned long int zonestart;
+	SDL_SpinLock zonelock;
 	SDL_Window *window = NULL;
 	SDL_Renderer *renderer = NULL;
 	SDL_Texture *renderbuffer = NULL;
+	unsigned int *offscreen = NULL;
 	unsigned char *framebuffer = NULL;
+	unsigned char *flipbuffer = NULL;
+	unsigned char *shadowbuffer = NULL;
+	bool refresh = true;
+	RETRO_DirtyRows dirty;
+	RETRO_DirtyRows flipdirty;
 	unsigned int palette[RETRO_COLORS];
+	unsigned int flippalette[RETRO_COLORS];
+	RETRO_ExpandFunc expand = NULL;
+	SDL_Thread *renderthread = NULL;
+	SDL_sem *renderstart = NULL;
+	SDL_sem *renderdone = NULL;
+	double renderdelta;
+	bool renderquit;
 	RETRO_Image *image[RETRO_MAX_IMAGES];
 	int images = 0;
 	const unsigned char *keystate;
 	bool keydown[256];
 	int yoffset[RETRO_HEIGHT];
-} RETRO = { .mode = RETRO_MODE_FULLSCREEN, .vsync = true, .showfps = true };
+} RETRO = { .mode = RETRO_MODE_FULLSCREEN, .vsync = true, .showfps = true, .autoclear = true };
 
 // *******************************************************************
 // Public functions
@@ -109,8 +192,53 @@ void RETRO_RageQuit(const char *message, const char *error = "")
 	exit(-1);
 }
 
+void RETRO_DamageRows(RETRO_DirtyRows *dirty, int x1, int y1, int x2, int y2)
+{
+	if (dirty->full) return;
+	if (y1 < dirty->top) dirty->top = y1;
+	if (y2 > dirty->bottom) dirty->bottom = y2;
+	for (int y = y1; y < y2; y++) {
+		if (x1 < dirty->left[y]) dirty->left[y] = x1;
+		if (x2 > dirty->right[y]) dirty->right[y] = x2;
+	}
+}
+
+void RETRO_ResetRows(RETRO_DirtyRows *dirty)
+{
+	dirty->full = false;
+	dirty->top = RETRO_HEIGHT;
+	dirty->bottom = 0;
+	for (int y = 0; y < RETRO_HEIGHT; y++) {
+		dirty->left[y] = RETRO_WIDTH;
+		dirty->right[y] = 0;
+	}
+}
+
+void RETRO_Damage(int x1, int y1, int x2, int y2)
+{
+	// Record the framebuffer rectangle x1,y1 - x2,y2 (exclusive) as changed
+	if (RETRO.dirty.full) return;
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 > RETRO_WIDTH) x2 = RETRO_WIDTH;
+	if (y2 > RETRO_HEIGHT) y2 = RETRO_HEIGHT;
+	if (x1 >= x2 || y1 >= y2) return;
+
+	RETRO_DamageRows(&RETRO.dirty, x1, y1, x2, y2);
+}
+
+void RETRO_DamageAll(void)
+{
+	// After a RETRO_Clear or a write through RETRO_FrameBuffer every other
+	// primitive of the frame can skip its own damage
+	RETRO_Damage(0, 0, RETRO_WIDTH, RETRO_HEIGHT);
+	RETRO.dirty.full = true;
+}
+
 unsigned char *RETRO_FrameBuffer(void)
 {
+	// The caller may write anywhere through the returned pointer
+	RETRO_DamageAll();
 	return RETRO.framebuffer;
 }
 
@@ -157,6 +285,7 @@ void RETRO_Set6bitPalette(RETRO_Palette *palette, int colors = RETRO_COLORS)
 void RETRO_PutPixel(int x, int y, unsigned char color)
 {
 	RETRO.framebuffer[RETRO.yoffset[y] + x] = color;
+	RETRO_Damage(x, y, x + 1, y + 1);
 }
 
 unsigned char RETRO_GetPixel(int x, int y)
@@ -167,11 +296,15 @@ unsigned char RETRO_GetPixel(int x, int y)
 void RETRO_Clear(unsigned char color = 0)
 {
 	memset(RETRO.framebuffer, color, RETRO_WIDTH * RETRO_HEIGHT);
+	RETRO_DamageAll();
 }
 
 void RETRO_Blit(unsigned char *src, int size = RETRO_WIDTH * RETRO_HEIGHT, unsigned char *dest = RETRO.framebuffer)
 {
 	memcpy(dest, src, size);
+	if (dest == RETRO.framebuffer) {
+		RETRO_Damage(0, 0, RETRO_WIDTH, (size + RETRO_WIDTH - 1) / RETRO_WIDTH);
+	}
 }
 
 int *RETRO_Yoffset(void)
@@ -273,28 +406,240 @@ RETRO_Image *RETRO_LoadImage(const char *filename)
 	return image;
 }
 
-void RETRO_Flip(void)
+void RETRO_ExpandScalar(unsigned int *dest, const unsigned char *src, int count, const unsigned int *palette)
 {
-	// Copy framebuffer
-	unsigned int *pixels, pitch;
-	SDL_LockTexture(RETRO.renderbuffer, NULL, (void **)&pixels, (int *)&pitch);
-	for (int i = 0; i < RETRO_WIDTH * RETRO_HEIGHT; i++) {
-		pixels[i] = RETRO.palette[RETRO.framebuffer[i]];
+	for (int i = 0; i < count; i++) {
+		dest[i] = palette[src[i]];
+	}
+}
+
+#ifdef RETRO_X86
+__attribute__((target("sse2")))
+void RETRO_ExpandSSE2(unsigned int *dest, const unsigned char *src, int count, const unsigned int *palette)
+{
+	int i = 0;
+
+	// Fetch four indices with one load and store four pixels at a time
+	for (; i + 4 <= count; i += 4) {
+		unsigned int index;
+		memcpy(&index, &src[i], 4);
+		__m128i pixels = _mm_setr_epi32(palette[index & 255], palette[(index >> 8) & 255], palette[(index >> 16) & 255], palette[index >> 24]);
+		_mm_storeu_si128((__m128i *)&dest[i], pixels);
+	}
+	for (; i < count; i++) {
+		dest[i] = palette[src[i]];
+	}
+}
+
+__attribute__((target("avx2")))
+void RETRO_ExpandAVX2(unsigned int *dest, const unsigned char *src, int count, const unsigned int *palette)
+{
+	int i = 0;
+
+	// Widen eight indices to 32 bits and gather their colors in one go
+	for (; i + 8 <= count; i += 8) {
+		__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&src[i]));
+		__m256i pixels = _mm256_i32gather_epi32((const int *)palette, index, 4);
+		_mm256_storeu_si256((__m256i *)&dest[i], pixels);
 	}
+	for (; i < count; i++) {
+		dest[i] = palette[src[i]];
+	}
+}
+#endif
+
+RETRO_ExpandFunc RETRO_SelectExpand(void)
+{
+#ifdef RETRO_X86
+	if (SDL_HasAVX2()) {
+		return RETRO_ExpandAVX2;
+	} else if (SDL_HasSSE2()) {
+		return RETRO_ExpandSSE2;
+	}
+#endif
+	return RETRO_ExpandScalar;
+}
+
+void RETRO_Expand(unsigned char *pixels, int pitch, int x, int y, int width, int height)
+{
+	// Convert a framebuffer rectangle to ARGB8888, one texture row at a time unless the rows are packed
+	if (width == RETRO_WIDTH && pitch == RETRO_WIDTH * 4) {
+		RETRO.expand((unsigned int *)pixels, RETRO.flipbuffer + RETRO.yoffset[y], width * height, RETRO.flippalette);
+	} else {
+		for (int i = 0; i < height; i++) {
+			RETRO.expand((unsigned int *)(pixels + i * pitch), RETRO.flipbuffer + RETRO.yoffset[y + i] + x, width, RETRO.flippalette);
+		}
+	}
+}
+
+bool RETRO_DiffSpan(int y, int *left, int *right)
+{
+	// Narrow the dirty span of a row to the bytes that differ from the last uploaded frame
+	unsigned char *a = RETRO.flipbuffer + RETRO.yoffset[y];
+	unsigned char *b = RETRO.shadowbuffer + RETRO.yoffset[y];
+	int x1 = *left;
+	int x2 = *right;
+
+	if (memcmp(&a[x1], &b[x1], x2 - x1) == 0) return false;
+	while (a[x1] == b[x1]) x1++;
+	while (a[x2 - 1] == b[x2 - 1]) x2--;
+
+	memcpy(&b[x1], &a[x1], x2 - x1);
+	*left = x1;
+	*right = x2;
+	return true;
+}
+
+void RETRO_UploadBand(int x1, int y1, int x2, int y2)
+{
+	// Headless mode converts into the offscreen buffer instead of the texture
+	if (RETRO.headless) {
+		RETRO_Expand((unsigned char *)&RETRO.offscreen[RETRO.yoffset[y1] + x1], RETRO_WIDTH * 4, x1, y1, x2 - x1, y2 - y1);
+		return;
+	}
+
+	unsigned char *pixels;
+	int pitch;
+	SDL_Rect rect = { x1, y1, x2 - x1, y2 - y1 };
+	SDL_LockTexture(RETRO.renderbuffer, &rect, (void **)&pixels, &pitch);
+	RETRO_Expand(pixels, pitch, rect.x, rect.y, rect.w, rect.h);
 	SDL_UnlockTexture(RETRO.renderbuffer);
+}
 
-	SDL_RenderClear(RETRO.renderer);
-	SDL_RenderCopy(RETRO.renderer, RETRO.renderbuffer, NULL, NULL);
-	SDL_RenderPresent(RETRO.renderer);
+void RETRO_Snapshot(void)
+{
+	// Hand the finished frame over to the flip, together with its palette and damage
+	if (RETRO.pipeline) {
+		SWAP(RETRO.framebuffer, RETRO.flipbuffer);
+
+		// The buffer coming back from the flip still holds the frame before the
+		// one just finished, it misses exactly that frame's damage. Without the
+		// automatic clear the next frame draws over it, so copy the damage
+		// across and the next damage is again relative to what the texture holds
+		if (!RETRO.autoclear) {
+			if (RETRO.dirty.full) {
+				memcpy(RETRO.framebuffer, RETRO.flipbuffer, RETRO_WIDTH * RETRO_HEIGHT);
+			} else {
+				for (int y = RETRO.dirty.top; y < RETRO.dirty.bottom; y++) {
+					int x1 = RETRO.dirty.left[y];
+					int x2 = RETRO.dirty.right[y];
+					if (x1 < x2) {
+						memcpy(RETRO.framebuffer + RETRO.yoffset[y] + x1, RETRO.flipbuffer + RETRO.yoffset[y] + x1, x2 - x1);
+					}
+				}
+			}
+		}
+	}
+	RETRO.flipdirty = RETRO.dirty;
+	RETRO_ResetRows(&RETRO.dirty);
+
+	if (memcmp(RETRO.flippalette, RETRO.palette, sizeof(RETRO.palette)) != 0) {
+		memcpy(RETRO.flippalette, RETRO.palette, sizeof(RETRO.palette));
+		RETRO.refresh = true;
+	}
 }
 
-void RETRO_Initialize(void)
+void RETRO_Upload(void)
 {
-	// Initialize SDL
-	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-		RETRO_RageQuit("SDL_Init failed: %s\n", SDL_GetError());
+	if (RETRO.refresh) {
+		// Palette changed, convert everything
+		RETRO_UploadBand(0, 0, RETRO_WIDTH, RETRO_HEIGHT);
+		memcpy(RETRO.shadowbuffer, RETRO.flipbuffer, RETRO_WIDTH * RETRO_HEIGHT);
+		RETRO.refresh = false;
+	} else {
+		// Lock and convert each band of consecutive changed rows
+		int top = -1, left = RETRO_WIDTH, right = 0;
+		for (int y = RETRO.flipdirty.top; y < RETRO.flipdirty.bottom; y++) {
+			int x1 = RETRO.flipdirty.left[y];
+			int x2 = RETRO.flipdirty.right[y];
+			if (x1 < x2 && RETRO_DiffSpan(y, &x1, &x2)) {
+				if (top < 0) top = y;
+				left = SDL_min(left, x1);
+				right = SDL_max(right, x2);
+			} else if (top >= 0) {
+				RETRO_UploadBand(left, top, right, y);
+				top = -1;
+				left = RETRO_WIDTH;
+				right = 0;
+			}
+		}
+		if (top >= 0) {
+			RETRO_UploadBand(left, top, right, RETRO.flipdirty.bottom);
+		}
+	}
+}
+
+void RETRO_SaveFrame(const char *filename)
+{
+	// Save the offscreen buffer as a binary PPM image
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		RETRO_RageQuit("Cannot open file: %s\n", filename);
+	}
+
+	fprintf(fp, "P6\n%d %d\n255\n", RETRO_WIDTH, RETRO_HEIGHT);
+	for (int i = 0; i < RETRO_WIDTH * RETRO_HEIGHT; i++) {
+		fputc(RETRO.offscreen[i] >> 16, fp);
+		fputc(RETRO.offscreen[i] >> 8, fp);
+		fputc(RETRO.offscreen[i], fp);
 	}
 
+	fclose(fp);
+}
+
+void RETRO_SaveProfile(const char *filename)
+{
+	// Write the zones as complete events of a Chrome trace, readable by
+	// about:tracing and Perfetto
+	FILE *fp = fopen(filename, "w");
+	if (fp == NULL) {
+		printf("Cannot open file: %s\n", filename);
+		return;
+	}
+
+	double usec = 1000000.0 / SDL_GetPerformanceFrequency();
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (int i = 0; i < RETRO.zonecount; i++) {
+		RETRO_ZoneEvent *zone = &RETRO.zones[i];
+		fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+			zone->name, (unsigned long)zone->thread, (zone->start - RETRO.zonestart) * usec,
+			(zone->stop - zone->start) * usec, i < RETRO.zonecount - 1 ? "," : "");
+	}
+	fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	fclose(fp);
+
+	if (RETRO.zonesdropped) {
+		printf("Profile full, %d zones dropped\n", RETRO.zonesdropped);
+	}
+}
+
+void RETRO_Present(void)
+{
+	if (RETRO.headless) {
+		if (RETRO.dumpframes) {
+			char filename[PATH_MAX];
+			snprintf(filename, PATH_MAX, "%s%05d.ppm", RETRO.dumpframes, RETRO.frames);
+			RETRO_SaveFrame(filename);
+		}
+	} else {
+		SDL_RenderClear(RETRO.renderer);
+		SDL_RenderCopy(RETRO.renderer, RETRO.renderbuffer, NULL, NULL);
+		SDL_RenderPresent(RETRO.renderer);
+	}
+	RETRO.frames++;
+}
+
+void RETRO_Flip(void)
+{
+	// Copy framebuffer
+	RETRO_Snapshot();
+	RETRO_Upload();
+	RETRO_Present();
+}
+
+void RETRO_InitializeWindow(void)
+{
 	// Get current display mode
 	SDL_DisplayMode dm;
 	if (SDL_GetCurrentDisplayMode(0, &dm) != 0) {
@@ -336,6 +681,27 @@ void RETRO_Initialize(void)
 	// Create render buffer
 	RETRO.renderbuffer = SDL_CreateTexture(RETRO.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, RETRO_WIDTH, RETRO_HEIGHT);
 
+	// Cursor
+	SDL_ShowCursor(RETRO.showcursor);
+}
+
+void RETRO_Initialize(void)
+{
+	// Initialize SDL, without video when running headless
+	if (SDL_Init(RETRO.headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) != 0) {
+		RETRO_RageQuit("SDL_Init failed: %s\n", SDL_GetError());
+	}
+
+	if (RETRO.headless) {
+		// Create offscreen buffer that stands in for the render buffer
+		RETRO.offscreen = (unsigned int *)malloc(RETRO_WIDTH * RETRO_HEIGHT * sizeof(unsigned int));
+		if (RETRO.offscreen == NULL) {
+			RETRO_RageQuit("Cannot allocate offscreen memory\n");
+		}
+	} else {
+		RETRO_InitializeWindow();
+	}
+
 	// Create framebuffer
 	RETRO.framebuffer = (unsigned char *)malloc(RETRO_WIDTH * RETRO_HEIGHT);
 	if (RETRO.framebuffer == NULL) {
@@ -343,29 +709,73 @@ void RETRO_Initialize(void)
 	}
 	memset(RETRO.framebuffer, 0, RETRO_WIDTH * RETRO_HEIGHT);
 
-	// Cursor
-	SDL_ShowCursor(RETRO.showcursor);
+	// Create second framebuffer, flipped while the next frame is rendered
+	if (RETRO.pipeline) {
+		RETRO.flipbuffer = (unsigned char *)malloc(RETRO_WIDTH * RETRO_HEIGHT);
+		if (RETRO.flipbuffer == NULL) {
+			RETRO_RageQuit("Cannot allocate framebuffer memory\n");
+		}
+		memset(RETRO.flipbuffer, 0, RETRO_WIDTH * RETRO_HEIGHT);
+	} else {
+		RETRO.flipbuffer = RETRO.framebuffer;
+	}
+
+	// Create shadow of the uploaded framebuffer, used to skip unchanged rows
+	RETRO.shadowbuffer = (unsigned char *)malloc(RETRO_WIDTH * RETRO_HEIGHT);
+	if (RETRO.shadowbuffer == NULL) {
+		RETRO_RageQuit("Cannot allocate framebuffer memory\n");
+	}
+	RETRO.refresh = true;
+	RETRO_ResetRows(&RETRO.dirty);
+
+	// Select palette expansion kernel for this CPU
+	RETRO.expand = RETRO_SelectExpand();
 
 	// Build Y offset table
 	for (int y = 0; y < RETRO_HEIGHT; y++) {
 		RETRO.yoffset[y] = y * RETRO_WIDTH;
 	}
 
+	// Zone times are written relative to the start
+	RETRO.zonestart = SDL_GetPerformanceCounter();
+
 	if (RETRO_Initialize_3D != NULL) RETRO_Initialize_3D();
 }
 
 void RETRO_Deinitialize(void)
 {
 	if (RETRO_Deinitialize_3D != NULL) RETRO_Deinitialize_3D();
+	if (RETRO_Deinitialize_Threads != NULL) RETRO_Deinitialize_Threads();
 
 	for (int i = 0; i < RETRO_MAX_IMAGES; i++) {
 		RETRO_FreeImage(i);
 	}
 
+	if (RETRO.flipbuffer && RETRO.flipbuffer != RETRO.framebuffer) {
+		free(RETRO.flipbuffer);
+	}
+
 	if (RETRO.framebuffer) {
 		free(RETRO.framebuffer);
 	}
 
+	if (RETRO.shadowbuffer) {
+		free(RETRO.shadowbuffer);
+	}
+
+	if (RETRO.offscreen) {
+		free(RETRO.offscreen);
+	}
+
+	for (int i = 0; i < RETRO_STAGES; i++) {
+		free(RETRO.stagetime[i]);
+	}
+
+	if (RETRO.profile) {
+		RETRO_SaveProfile(RETRO.profile);
+		free(RETRO.zones);
+	}
+
 	SDL_DestroyTexture(RETRO.renderbuffer);
 	SDL_DestroyRenderer(RETRO.renderer);
 	SDL_DestroyWindow(RETRO.window);
@@ -374,10 +784,19 @@ void RETRO_Deinitialize(void)
 
 void RETRO_SetVSync(bool state = true)
 {
-	SDL_RenderSetVSync(RETRO.renderer, state);
+	if (RETRO.renderer) {
+		SDL_RenderSetVSync(RETRO.renderer, state);
+	}
 	RETRO.vsync = state;
 }
 
+void RETRO_SetAutoClear(bool state = true)
+{
+	// A demo that redraws everything it changes can turn the clear off, the
+	// damage of its primitives then bounds what RETRO_Flip converts
+	RETRO.autoclear = state;
+}
+
 double RETRO_DeltaTime(void)
 {
 	static unsigned long int now = SDL_GetPerformanceCounter();
@@ -389,14 +808,134 @@ double RETRO_DeltaTime(void)
 	return (double)(now - old) / SDL_GetPerformanceFrequency();
 }
 
+double RETRO_Benchmark(const char *name, void (*func)(void *), void *data, int iterations, double baseline = 0)
+{
+	// Warm up caches, then report the average time of one call and the speedup against a baseline
+	func(data);
+
+	unsigned long int start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < iterations; i++) {
+		func(data);
+	}
+	unsigned long int stop = SDL_GetPerformanceCounter();
+
+	double usec = (double)(stop - start) * 1000000 / SDL_GetPerformanceFrequency() / iterations;
+	if (baseline > 0) {
+		printf("%-32s %10.2f us %8.2fx\n", name, usec, baseline / usec);
+	} else {
+		printf("%-32s %10.2f us\n", name, usec);
+	}
+	return usec;
+}
+
+int RETRO_CompareTimes(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+void RETRO_FrameTimeStats(RETRO_FrameStats *stats)
+{
+	// Percentiles and log2 histogram of the frame times in the ring buffer
+	float times[RETRO_FRAMETIMES];
+	int frames = SDL_min(RETRO.frametimecount, RETRO_FRAMETIMES);
+
+	memset(stats, 0, sizeof(RETRO_FrameStats));
+	if (frames == 0) {
+		return;
+	}
+
+	for (int i = 0; i < frames; i++) {
+		times[i] = RETRO.frametime[i];
+
+		// Bucket 0 is below 0.25 ms, bucket n covers 0.125 * 2^n up to twice that
+		int octave;
+		frexp(times[i] / 0.125, &octave);
+		stats->histogram[SDL_min(SDL_max(octave - 1, 0), RETRO_HISTOGRAM - 1)]++;
+	}
+	qsort(times, frames, sizeof(float), RETRO_CompareTimes);
+
+	stats->frames = frames;
+	stats->p50 = times[(frames * 50 + 99) / 100 - 1];
+	stats->p95 = times[(frames * 95 + 99) / 100 - 1];
+	stats->p99 = times[(frames * 99 + 99) / 100 - 1];
+	stats->max = times[frames - 1];
+}
+
+void RETRO_SaveFrameTimes(const char *filename)
+{
+	FILE *fp = fopen(filename, "w");
+	if (fp == NULL) {
+		printf("Cannot open file: %s\n", filename);
+		return;
+	}
+
+	// Oldest frame first
+	int frames = SDL_min(RETRO.frametimecount, RETRO_FRAMETIMES);
+	fprintf(fp, "frame,milliseconds\n");
+	for (int i = RETRO.frametimecount - frames; i < RETRO.frametimecount; i++) {
+		fprintf(fp, "%d,%.4f\n", i, RETRO.frametime[i % RETRO_FRAMETIMES]);
+	}
+
+	fclose(fp);
+}
+
+unsigned long int RETRO_BeginZone(void)
+{
+	return RETRO.profile ? SDL_GetPerformanceCounter() : 0;
+}
+
+void RETRO_EndZone(const char *name, unsigned long int start)
+{
+	// Record a complete zone, zones on the same thread nest by their times
+	if (RETRO.profile == NULL) {
+		return;
+	}
+	unsigned long int stop = SDL_GetPerformanceCounter();
+
+	SDL_AtomicLock(&RETRO.zonelock);
+	if (RETRO.zonecount == RETRO.zonecapacity && RETRO.zonecapacity < RETRO_MAX_ZONES) {
+		int capacity = RETRO.zonecapacity ? RETRO.zonecapacity * 2 : 4096;
+		RETRO_ZoneEvent *zones = (RETRO_ZoneEvent *)realloc(RETRO.zones, capacity * sizeof(RETRO_ZoneEvent));
+		if (zones) {
+			RETRO.zones = zones;
+			RETRO.zonecapacity = capacity;
+		}
+	}
+	if (RETRO.zonecount < RETRO.zonecapacity) {
+		RETRO_ZoneEvent *zone = &RETRO.zones[RETRO.zonecount++];
+		zone->name = name;
+		zone->start = start;
+		zone->stop = stop;
+		zone->thread = SDL_ThreadID();
+	} else {
+		RETRO.zonesdropped++;
+	}
+	SDL_AtomicUnlock(&RETRO.zonelock);
+}
+
+struct RETRO_Zone {
+	const char *name;
+	unsigned long int start;
+	RETRO_Zone(const char *name) : name(name), start(RETRO_BeginZone()) {}
+	~RETRO_Zone() { RETRO_EndZone(name, start); }
+};
+
+// Profile the rest of the enclosing scope, name must be a string literal
+#define RETRO_PROFILE_CONCAT(a, b) a##b
+#define RETRO_PROFILE_ZONE(name, line) RETRO_Zone RETRO_PROFILE_CONCAT(_RETRO_Zone, line)(name)
+#define RETRO_PROFILE(name) RETRO_PROFILE_ZONE(name, __LINE__)
+
 bool RETRO_KeyState(SDL_Scancode key)
 {
+	// A timedemo only plays back recorded input
+	if (RETRO.timedemo) return false;
 	return RETRO.keystate[key];
 }
 
 bool RETRO_KeyPressed(SDL_Scancode key)
 {
-	if (key > 255) return false;
+	if (key > 255 || RETRO.timedemo) return false;
 	if (RETRO.keystate[key]) {
 		if (RETRO.keydown[key]) {
 			return false;
@@ -409,11 +948,21 @@ bool RETRO_KeyPressed(SDL_Scancode key)
 	return false;
 }
 
+void RETRO_Quit(void)
+{
+	// Leave the main loop once the current frame is done
+	RETRO.quit = true;
+}
+
 bool RETRO_QuitRequested(void)
 {
 	SDL_PumpEvents();
 	RETRO.keystate = SDL_GetKeyboardState(NULL);
-	if (SDL_QuitRequested()) {
+	if (RETRO.quit) {
+		return true;
+	} else if (RETRO.maxframes && RETRO.frames >= RETRO.maxframes) {
+		return true;
+	} else if (SDL_QuitRequested()) {
 		return true;
 	} else if (RETRO.keystate[SDL_SCANCODE_ESCAPE]) {
 		return true;
@@ -427,30 +976,413 @@ bool RETRO_QuitRequested(void)
 // Private functions
 // *******************************************************************
 
+struct RETRO_ExpandBenchmark {
+	RETRO_ExpandFunc expand;
+	unsigned int *pixels;
+};
+
+void RETRO_BenchmarkExpand(void *data)
+{
+	RETRO_ExpandBenchmark *bench = (RETRO_ExpandBenchmark *)data;
+	bench->expand(bench->pixels, RETRO.framebuffer, RETRO_WIDTH * RETRO_HEIGHT, RETRO.palette);
+}
+
+void RETRO_BenchmarkFlip(void *data)
+{
+	RETRO.refresh = true;
+	RETRO_Flip();
+}
+
+void RETRO_BenchmarkFlipUnchanged(void *data)
+{
+	RETRO_DamageAll();
+	RETRO_Flip();
+}
+
+void RETRO_Benchmarks(void)
+{
+	printf("%s: %dx%d\n", RETRO.basename, RETRO_WIDTH, RETRO_HEIGHT);
+
+	// Fill framebuffer with noise so every palette entry is touched
+	for (int i = 0; i < RETRO_WIDTH * RETRO_HEIGHT; i++) {
+		RETRO.framebuffer[i] = rand();
+	}
+
+	// Palette expansion kernels
+	RETRO_ExpandBenchmark bench;
+	bench.pixels = (unsigned int *)malloc(RETRO_WIDTH * RETRO_HEIGHT * sizeof(unsigned int));
+	if (bench.pixels == NULL) {
+		RETRO_RageQuit("Cannot allocate benchmark memory\n");
+	}
+
+	bench.expand = RETRO_ExpandScalar;
+	double scalar = RETRO_Benchmark("expand scalar", RETRO_BenchmarkExpand, &bench, 200);
+#ifdef RETRO_X86
+	if (SDL_HasSSE2()) {
+		bench.expand = RETRO_ExpandSSE2;
+		RETRO_Benchmark("expand sse2", RETRO_BenchmarkExpand, &bench, 200, scalar);
+	}
+	if (SDL_HasAVX2()) {
+		bench.expand = RETRO_ExpandAVX2;
+		RETRO_Benchmark("expand avx2", RETRO_BenchmarkExpand, &bench, 200, scalar);
+	}
+#endif
+	free(bench.pixels);
+
+	// Complete flip, including texture upload and present
+	RETRO_Benchmark("flip", RETRO_BenchmarkFlip, NULL, 100);
+	RETRO_Benchmark("flip unchanged", RETRO_BenchmarkFlipUnchanged, NULL, 100);
+
+	if (RETRO_Benchmarks_Gfx != NULL) RETRO_Benchmarks_Gfx();
+	if (DEMO_Benchmark != NULL) DEMO_Benchmark();
+}
+
+void RETRO_RecordFrameTime(void)
+{
+	// Time between two passes of the main loop, the first pass has nothing to compare with
+	unsigned long int now = SDL_GetPerformanceCounter();
+
+	if (RETRO.lastframe) {
+		RETRO.frametime[RETRO.frametimecount++ % RETRO_FRAMETIMES] = (float)((now - RETRO.lastframe) * 1000.0 / SDL_GetPerformanceFrequency());
+
+		// Sorting the ring buffer every frame would cost more than it shows
+		if (RETRO.showtimes && RETRO.frametimecount % 16 == 0) {
+			RETRO_FrameTimeStats(&RETRO.framestats);
+		}
+	}
+	RETRO.lastframe = now;
+}
+
+void RETRO_DrawFrameTimes(void)
+{
+	// Percentiles on the first row and a bar per histogram octave below them,
+	// in the brightest and darkest colors of the current palette
+	RETRO_FrameStats *stats = &RETRO.framestats;
+	int bright = 0, dark = 0, bestbright = -1, bestdark = 1 << 30;
+	for (int i = 0; i < RETRO_COLORS; i++) {
+		unsigned int c = RETRO.palette[i];
+		int luma = ((c >> 16) & 255) * 2 + ((c >> 8) & 255) * 5 + (c & 255);
+		if (luma > bestbright) bestbright = luma, bright = i;
+		if (luma < bestdark) bestdark = luma, dark = i;
+	}
+
+	// The box shrinks to fit small framebuffers, text and bars that do not fit are cut
+	int x = 4, y = 4;
+	int width = SDL_min(296, RETRO_WIDTH - x);
+	int height = SDL_min(12 + RETRO_HISTOGRAM * 8 + 4, RETRO_HEIGHT - y);
+	if (width <= 0 || height <= 0) return;
+	int chars = SDL_max(RETRO_WIDTH - x - 2, 0) / 8 + 1; // 8 pixel glyphs that fit on the screen, plus the terminator
+
+	for (int row = y; row < y + height; row++) {
+		memset(RETRO.framebuffer + RETRO.yoffset[row] + x, dark, width);
+	}
+	RETRO_Damage(x, y, x + width, y + height);
+
+	if (RETRO_PutString != NULL && height >= 10) {
+		char text[64];
+		snprintf(text, SDL_min(64, chars), "P50 %.1f P95 %.1f P99 %.1f MAX %.1f", stats->p50, stats->p95, stats->p99, stats->max);
+		RETRO_PutString(text, x + 2, y + 2, bright);
+	}
+
+	int most = 1;
+	for (int i = 0; i < RETRO_HISTOGRAM; i++) {
+		most = SDL_max(most, stats->histogram[i]);
+	}
+	for (int i = 0; i < RETRO_HISTOGRAM; i++) {
+		int top = y + 12 + i * 8;
+		if (top + 8 > y + height) {
+			break;
+		}
+		if (RETRO_PutString != NULL) {
+			char text[16];
+			snprintf(text, SDL_min(16, chars), i == RETRO_HISTOGRAM - 1 ? ">%g" : "<%g", 0.25 * (1 << SDL_min(i, RETRO_HISTOGRAM - 2)));
+			RETRO_PutString(text, x + 2, top, bright);
+		}
+		int bar = SDL_max(width - 60, 0) * stats->histogram[i] / most;
+		for (int row = top + 1; row < top + 7; row++) {
+			memset(RETRO.framebuffer + RETRO.yoffset[row] + x + 56, bright, bar);
+		}
+	}
+}
+
+void RETRO_FrameTimeReport(void)
+{
+	RETRO_FrameStats stats;
+	RETRO_FrameTimeStats(&stats);
+
+	printf("frame times of the last %d frames: p50 %.3f p95 %.3f p99 %.3f max %.3f ms\n", stats.frames, stats.p50, stats.p95, stats.p99, stats.max);
+	for (int i = 0; i < RETRO_HISTOGRAM; i++) {
+		double low = i ? 0.125 * (1 << i) : 0;
+		if (i == RETRO_HISTOGRAM - 1) {
+			printf("%8.3f ms -          %6d\n", low, stats.histogram[i]);
+		} else {
+			printf("%8.3f ms - %8.3f %6d\n", low, 0.25 * (1 << i), stats.histogram[i]);
+		}
+	}
+}
+
+void RETRO_Simulate(double deltatime)
+{
+	// Run as many fixed steps as fit in the time that has passed, the rest is
+	// carried over and tells the renderer how far to interpolate
+	static double accumulator = 0;
+	if (DEMO_Update == NULL) {
+		return;
+	}
+
+	unsigned long int zone = RETRO_BeginZone();
+	accumulator = SDL_min(accumulator + deltatime, RETRO_MAX_STEPS * RETRO_TIMESTEP);
+	while (accumulator >= RETRO_TIMESTEP) {
+		DEMO_Update();
+		accumulator -= RETRO_TIMESTEP;
+	}
+	RETRO.alpha = accumulator / RETRO_TIMESTEP;
+	RETRO_EndZone("DEMO_Update", zone);
+}
+
+void RETRO_PaceFrame(void)
+{
+	// Wait for an absolute deadline one period after the previous one, so
+	// present times and rounding never add up to drift. Sleep while more than
+	// two ms remain, SDL_Delay can oversleep by about a ms, then spin the rest
+	double frequency = SDL_GetPerformanceFrequency();
+	double period = frequency / RETRO.fpscap;
+	double now = SDL_GetPerformanceCounter();
+
+	if (RETRO.deadline == 0) {
+		RETRO.deadline = now;
+		return;
+	}
+
+	RETRO.deadline += period;
+	if (now > RETRO.deadline) {
+		// Late, start over from here instead of rushing the frames that follow
+		RETRO.missedframes++;
+		RETRO.deadline = now;
+		return;
+	}
+
+	double remaining;
+	while ((remaining = (RETRO.deadline - now) * 1000 / frequency) > 2) {
+		SDL_Delay((unsigned int)remaining - 1);
+		now = SDL_GetPerformanceCounter();
+	}
+	while (now < RETRO.deadline) {
+		now = SDL_GetPerformanceCounter();
+	}
+
+	double error = (now - RETRO.deadline) * 1000 / frequency;
+	RETRO.pacingerror += error;
+	RETRO.maxpacingerror = SDL_max(RETRO.maxpacingerror, error);
+	RETRO.pacedframes++;
+}
+
+void RETRO_Pause(void)
+{
+	// Sleep in the event queue while SPACE is held, waking up at least every
+	// 100 ms to look at the keyboard. The window keeps showing the last frame
+	// and only needs presenting again when the system asks for it
+	SDL_Event event;
+
+	while (!RETRO_QuitRequested() && RETRO.keystate[SDL_SCANCODE_SPACE]) {
+		if (SDL_WaitEventTimeout(&event, 100)) {
+			if (event.type == SDL_QUIT) {
+				RETRO_Quit();
+			} else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED && RETRO.renderer) {
+				SDL_RenderClear(RETRO.renderer);
+				SDL_RenderCopy(RETRO.renderer, RETRO.renderbuffer, NULL, NULL);
+				SDL_RenderPresent(RETRO.renderer);
+			}
+		}
+	}
+
+	// Leave the pause out of the next delta time, frame time and pacing
+	RETRO_DeltaTime();
+	RETRO.lastframe = 0;
+	RETRO.deadline = 0;
+}
+
+void RETRO_BeginTimedFrame(void)
+{
+	// Make room for the stage times of one more timedemo frame
+	if (RETRO.timedframes == RETRO.timedcapacity) {
+		RETRO.timedcapacity = RETRO.timedcapacity ? RETRO.timedcapacity * 2 : 1024;
+		for (int i = 0; i < RETRO_STAGES; i++) {
+			RETRO.stagetime[i] = (float *)realloc(RETRO.stagetime[i], RETRO.timedcapacity * sizeof(float));
+			if (RETRO.stagetime[i] == NULL) {
+				RETRO_RageQuit("Cannot allocate timedemo memory\n");
+			}
+		}
+	}
+	for (int i = 0; i < RETRO_STAGES; i++) {
+		RETRO.stagetime[i][RETRO.timedframes] = 0;
+	}
+}
+
+void RETRO_EndStage(int stage, unsigned long int start)
+{
+	if (RETRO.timedemo) {
+		RETRO.stagetime[stage][RETRO.timedframes] += (float)((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+	}
+}
+
+void RETRO_TimedemoReport(void)
+{
+	static const char *name[RETRO_STAGES] = { "frame", "render", "upload", "present" };
+	int frames = RETRO.timedframes;
+	if (frames == 0) {
+		return;
+	}
+
+	double total = 0;
+	for (int i = 0; i < frames; i++) {
+		total += RETRO.stagetime[RETRO_STAGE_FRAME][i];
+	}
+	printf("timedemo: %d frames in %.3f s, %.1f fps\n", frames, total / 1000, frames * 1000 / total);
+
+	// Sorting destroys the frame order, which is not needed any more
+	printf("%-10s %10s %10s %10s\n", "stage", "avg ms", "min ms", "p99 ms");
+	for (int stage = 0; stage < RETRO_STAGES; stage++) {
+		float *times = RETRO.stagetime[stage];
+		double sum = 0;
+		for (int i = 0; i < frames; i++) {
+			sum += times[i];
+		}
+		qsort(times, frames, sizeof(float), RETRO_CompareTimes);
+		printf("%-10s %10.3f %10.3f %10.3f\n", name[stage], sum / frames, times[0], times[(frames * 99 + 99) / 100 - 1]);
+	}
+}
+
+int RETRO_RenderThread(void *data)
+{
+	// Render frames into the back buffer whenever the main loop asks for one
+	while (true) {
+		SDL_SemWait(RETRO.renderstart);
+		if (RETRO.renderquit) {
+			break;
+		}
+		unsigned long int start = SDL_GetPerformanceCounter();
+		RETRO_Simulate(RETRO.renderdelta);
+		unsigned long int zone = RETRO_BeginZone();
+		if (RETRO.autoclear) {
+			RETRO_Clear();
+		}
+		DEMO_Render(RETRO.renderdelta);
+		if (RETRO.showtimes) {
+			RETRO_DrawFrameTimes();
+		}
+		RETRO_EndZone("DEMO_Render", zone);
+		RETRO_EndStage(RETRO_STAGE_RENDER, start);
+		SDL_SemPost(RETRO.renderdone);
+	}
+	return 0;
+}
+
+void RETRO_StartRenderThread(void)
+{
+	RETRO.renderquit = false;
+	RETRO.renderstart = SDL_CreateSemaphore(0);
+	RETRO.renderdone = SDL_CreateSemaphore(0);
+	RETRO.renderthread = SDL_CreateThread(RETRO_RenderThread, "RETRO_Render", NULL);
+	if (RETRO.renderthread == NULL) {
+		RETRO_RageQuit("SDL_CreateThread failed: %s\n", SDL_GetError());
+	}
+}
+
+void RETRO_StopRenderThread(void)
+{
+	RETRO.renderquit = true;
+	SDL_SemPost(RETRO.renderstart);
+	SDL_WaitThread(RETRO.renderthread, NULL);
+	SDL_DestroySemaphore(RETRO.renderstart);
+	SDL_DestroySemaphore(RETRO.renderdone);
+	RETRO.renderthread = NULL;
+}
+
+void RETRO_RenderPipelined(double deltatime)
+{
+	// Render frame N+1 on the render thread while frame N is converted, uploaded
+	// and presented here, then wait for it so latency never exceeds one frame
+	RETRO.renderdelta = deltatime;
+	SDL_SemPost(RETRO.renderstart);
+	unsigned long int zone = RETRO_BeginZone();
+	unsigned long int start = SDL_GetPerformanceCounter();
+	RETRO_Upload();
+	RETRO_EndStage(RETRO_STAGE_UPLOAD, start);
+	start = SDL_GetPerformanceCounter();
+	RETRO_Present();
+	RETRO_EndStage(RETRO_STAGE_PRESENT, start);
+	RETRO_EndZone("RETRO_Flip", zone);
+	SDL_SemWait(RETRO.renderdone);
+
+	// Both threads are idle, swap buffers for the next round
+	RETRO_Snapshot();
+}
+
 void RETRO_Mainloop(void)
 {
+	bool pipeline = RETRO.pipeline && DEMO_Render != NULL;
+	if (pipeline) {
+		RETRO_StartRenderThread();
+	}
+
 	while (!RETRO_QuitRequested()) {
-		double deltatime = RETRO_DeltaTime();
+		// A timedemo advances by a fixed step so every run simulates the same frames
+		double deltatime = RETRO.timedemo ? RETRO_TIMESTEP : RETRO_DeltaTime();
 
 		// Check events
-		if (RETRO.keystate[SDL_SCANCODE_SPACE]) {
+		if (RETRO.keystate[SDL_SCANCODE_SPACE] && !RETRO.timedemo) {
+			RETRO_Pause();
 			continue;
 		}
 
 		// Render scene
-		unsigned long int start = SDL_GetTicks64();
-		if (DEMO_Render != NULL) {
-			RETRO_Clear();
+		if (RETRO.timedemo) {
+			RETRO_BeginTimedFrame();
+		}
+		unsigned long int framestart = SDL_GetPerformanceCounter();
+		unsigned long int framezone = RETRO_BeginZone();
+		if (pipeline) {
+			RETRO_RenderPipelined(deltatime);
+		} else if (DEMO_Render != NULL) {
+			unsigned long int stagestart = framestart;
+			RETRO_Simulate(deltatime);
+			unsigned long int zone = RETRO_BeginZone();
+			if (RETRO.autoclear) {
+				RETRO_Clear();
+			}
 			DEMO_Render(deltatime);
-			RETRO_Flip();
+			if (RETRO.showtimes) {
+				RETRO_DrawFrameTimes();
+			}
+			RETRO_EndZone("DEMO_Render", zone);
+			RETRO_EndStage(RETRO_STAGE_RENDER, stagestart);
+			zone = RETRO_BeginZone();
+			stagestart = SDL_GetPerformanceCounter();
+			RETRO_Snapshot();
+			RETRO_Upload();
+			RETRO_EndStage(RETRO_STAGE_UPLOAD, stagestart);
+			stagestart = SDL_GetPerformanceCounter();
+			RETRO_Present();
+			RETRO_EndStage(RETRO_STAGE_PRESENT, stagestart);
+			RETRO_EndZone("RETRO_Flip", zone);
 		} else if (DEMO_Render2 != NULL) {
+			RETRO_Simulate(deltatime);
+			unsigned long int zone = RETRO_BeginZone();
 			DEMO_Render2(deltatime);
+			RETRO_EndZone("DEMO_Render2", zone);
+			RETRO_EndStage(RETRO_STAGE_RENDER, framestart);
+		}
+		RETRO_EndZone("frame", framezone);
+		RETRO_RecordFrameTime();
+		if (RETRO.timedemo) {
+			RETRO_EndStage(RETRO_STAGE_FRAME, framestart);
+			RETRO.timedframes++;
 		}
-		unsigned long int stop = SDL_GetTicks64();
 
 		// Limit FPS
-		if (RETRO.fpscap && ((stop - start) < 1000UL / RETRO.fpscap)) {
-			SDL_Delay((1000 / RETRO.fpscap) - (stop - start));
+		if (RETRO.fpscap > 0) {
+			RETRO_PaceFrame();
 		}
 
 		// Show FPS once a second
@@ -460,13 +1392,35 @@ void RETRO_Mainloop(void)
 			if (fpsticks < SDL_GetTicks64() - 1000UL) {
 				char title[128];
 				snprintf(title, 128, "RETRO - %s - FPS: %d", RETRO.basename, fpscount);
-				SDL_SetWindowTitle(RETRO.window, title);
+				if (RETRO.headless) {
+					printf("%s\n", title);
+				} else {
+					SDL_SetWindowTitle(RETRO.window, title);
+				}
 				fpsticks = SDL_GetTicks();
 				fpscount = 0;
 			}
 			fpscount++;
 		}
 	}
+
+	if (pipeline) {
+		RETRO_StopRenderThread();
+	}
+
+	if (RETRO.timedemo) {
+		RETRO_TimedemoReport();
+	}
+
+	if (RETRO.pacedframes) {
+		printf("paced %d frames at %.3f fps: mean error %.3f ms, max %.3f ms, %d deadlines missed\n", RETRO.pacedframes, RETRO.fpscap,
+			RETRO.pacingerror / RETRO.pacedframes, RETRO.maxpacingerror, RETRO.missedframes);
+	}
+
+	if (RETRO.frametimes) {
+		RETRO_FrameTimeReport();
+		RETRO_SaveFrameTimes(RETRO.frametimes);
+	}
 }
 
 #endif
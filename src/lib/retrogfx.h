@@ -35,6 +35,100 @@ struct Point3Df {
 	float x, y, z;
 };
 
+struct RETRO_LineSpan {
+	int offset;          // Buffer offset of the first visible pixel
+	int count;           // Visible pixels
+	int step;            // Offset change of every step along the major axis
+	int minorstep;       // Offset change when the minor axis moves as well
+	int error;           // Bresenham accumulator at the first visible pixel
+	int minor, major;    // Accumulator increment and limit
+};
+
+struct RETRO_LayerSpan {
+	int offset;          // Buffer offset of the first pixel
+	int count;           // Opaque pixels in the run
+	int pixel;           // Index of the first pixel in the layer pixels
+};
+
+struct RETRO_Layer {
+	bool valid;                        // Cleared by RETRO_InvalidateLayer
+	const unsigned char *image;        // What the cache was built from
+	int imagewidth, imageheight, pitch;
+	int x, y, width, height;           // Destination rectangle
+	int key;                           // Transparent color, or -1
+	unsigned long long hash;           // Of the image pixels, catches edits in place
+	RETRO_LayerSpan *spans;            // Opaque runs of the scaled image, clipped to the buffer
+	int spancount, spancapacity;
+	unsigned char *pixels;             // Pixels of the runs
+	int pixelcount, pixelcapacity;
+	int left, top, right, bottom;      // Bounds of the runs
+};
+
+void RETRO_LineMoves(int start, int sign, int size, long long *low, long long *high)
+{
+	// Range of moves from start in direction sign that stay inside [0, size)
+	if (sign > 0) {
+		*low = -(long long)start;
+		*high = (long long)size - 1 - start;
+	} else {
+		*low = (long long)start - (size - 1);
+		*high = start;
+	}
+}
+
+bool RETRO_ClipLine(int x1, int y1, int x2, int y2, int width, int height, RETRO_LineSpan *span)
+{
+	// The line walks major steps, moving along the minor axis floor(k * minor / major)
+	// times in the first k steps. Work out the first and last step that land inside
+	// the buffer, so the walk visits exactly the pixels the unclipped walk would draw
+	long long dx = (long long)x2 - x1;
+	long long dy = (long long)y2 - y1;
+	int sdx = (dx < 0) ? -1 : 1;
+	int sdy = (dy < 0) ? -1 : 1;
+
+	dx = sdx * dx + 1;
+	dy = sdy * dy + 1;
+
+	long long xlow, xhigh, ylow, yhigh;
+	RETRO_LineMoves(x1, sdx, width, &xlow, &xhigh);
+	RETRO_LineMoves(y1, sdy, height, &ylow, &yhigh);
+
+	long long major, minor, low, high, minorlow, minorhigh;
+	if (dx >= dy) {
+		major = dx, minor = dy, low = xlow, high = xhigh, minorlow = ylow, minorhigh = yhigh;
+		span->step = sdx;
+		span->minorstep = sdy * width;
+	} else {
+		major = dy, minor = dx, low = ylow, high = yhigh, minorlow = xlow, minorhigh = xhigh;
+		span->step = sdy * width;
+		span->minorstep = sdx;
+	}
+	if (high < 0 || minorhigh < 0) {
+		return false;
+	}
+
+	long long first = SDL_max(low, 0);
+	long long last = SDL_min(high, major - 1);
+	if (minorlow > 0) {
+		first = SDL_max(first, (minorlow * major + minor - 1) / minor);
+	}
+	last = SDL_min(last, ((minorhigh + 1) * major - 1) / minor);
+	if (first > last) {
+		return false;
+	}
+
+	long long moves = first * minor / major;
+	long long x = x1 + sdx * (dx >= dy ? first : moves);
+	long long y = y1 + sdy * (dx >= dy ? moves : first);
+
+	span->offset = (int)(y * width + x);
+	span->count = (int)(last - first + 1);
+	span->error = (int)(first * minor % major);
+	span->minor = (int)minor;
+	span->major = (int)major;
+	return true;
+}
+
 bool RETRO_FadeIn(int steps, int step, RETRO_Palette *palette)
 {
 	if (step >= steps) return true;
@@ -66,42 +160,35 @@ bool RETRO_FadeOut(int steps, int step, RETRO_Palette *palette)
 void RETRO_DrawLine(int x1, int y1, int x2, int y2, unsigned char color, unsigned char *buffer = NULL, int width = RETRO_WIDTH, int height = RETRO_HEIGHT)
 {
 	buffer = buffer ? buffer : RETRO.framebuffer;
+	if (buffer == RETRO.framebuffer) {
+		RETRO_Damage(SDL_min(x1, x2), SDL_min(y1, y2), SDL_max(x1, x2) + 1, SDL_max(y1, y2) + 1);
+	}
 
-	int x = 0;
-	int y = 0;
-	int dx = x2 - x1;
-	int dy = y2 - y1;
-	int sdx = (dx < 0) ? -1 : 1;
-	int sdy = (dy < 0) ? -1 : 1;
-	int px = x1;
-	int py = y1;
-
-	dx = sdx * dx + 1;
-	dy = sdy * dy + 1;
+	RETRO_LineSpan span;
+	if (!RETRO_ClipLine(x1, y1, x2, y2, width, height, &span)) {
+		return;
+	}
 
-	if (dx >= dy) {
-		for (x = 0; x < dx; x++) {
-			if (px >= 0 && px < width && py >= 0 && py < height) {
-				buffer[py * width + px] = color;
-			}
-			y += dy;
-			if (y >= dx) {
-				y -= dx;
-				py += sdy;
-			}
-			px += sdx;
+	unsigned char *dest = buffer + span.offset;
+	if (span.minor == 1 && (span.step == 1 || span.step == -1)) {
+		// Horizontal
+		memset(span.step > 0 ? dest : dest - (span.count - 1), color, span.count);
+	} else if (span.minor == 1) {
+		// Vertical
+		for (int i = 0; i < span.count; i++) {
+			*dest = color;
+			dest += span.step;
 		}
 	} else {
-		for (y = 0; y < dy; y++) {
-			if (px >= 0 && px < width && py >= 0 && py < height) {
-				buffer[py * width + px] = color;
-			}
-			x += dx;
-			if (x >= dy) {
-				x -= dy;
-				px += sdx;
+		int error = span.error;
+		for (int i = 0; i < span.count; i++) {
+			*dest = color;
+			error += span.minor;
+			if (error >= span.major) {
+				error -= span.major;
+				dest += span.minorstep;
 			}
-			py += sdy;
+			dest += span.step;
 		}
 	}
 }
@@ -109,54 +196,45 @@ void RETRO_DrawLine(int x1, int y1, int x2, int y2, unsigned char color, unsigne
 void RETRO_DrawFireLine(int x1, int y1, int x2, int y2, unsigned char color, unsigned char intensity, unsigned char *buffer = NULL, int width = RETRO_WIDTH, int height = RETRO_HEIGHT)
 {
 	buffer = buffer ? buffer : RETRO.framebuffer;
+	if (buffer == RETRO.framebuffer) {
+		RETRO_Damage(SDL_min(x1, x2), SDL_min(y1, y2), SDL_max(x1, x2) + 1, SDL_max(y1, y2) + 1);
+	}
 
-	int x = 0;
-	int y = 0;
-	int dx = x2 - x1;
-	int dy = y2 - y1;
-	int sdx = (dx < 0) ? -1 : 1;
-	int sdy = (dy < 0) ? -1 : 1;
-	int px = x1;
-	int py = y1;
-
-	dx = sdx * dx + 1;
-	dy = sdy * dy + 1;
+	// Only visible pixels draw a random number, in the same order as before
+	RETRO_LineSpan span;
+	if (!RETRO_ClipLine(x1, y1, x2, y2, width, height, &span)) {
+		return;
+	}
 
-	if (dx >= dy) {
-		for (x = 0; x < dx; x++) {
-			if (px >= 0 && px < width && py >= 0 && py < height) {
-				buffer[py * width + px] = color + RANDOM(intensity);
-			}
-			y += dy;
-			if (y >= dx) {
-				y -= dx;
-				py += sdy;
-			}
-			px += sdx;
-		}
-	} else {
-		for (y = 0; y < dy; y++) {
-			if (px >= 0 && px < width && py >= 0 && py < height) {
-				buffer[py * width + px] = color + RANDOM(intensity);
-			}
-			x += dx;
-			if (x >= dy) {
-				x -= dy;
-				px += sdx;
-			}
-			py += sdy;
+	unsigned char *dest = buffer + span.offset;
+	int error = span.error;
+	for (int i = 0; i < span.count; i++) {
+		*dest = color + RANDOM(intensity);
+		error += span.minor;
+		if (error >= span.major) {
+			error -= span.major;
+			dest += span.minorstep;
 		}
+		dest += span.step;
 	}
 }
 
 void RETRO_DrawVline(int x, int y1, int y2, unsigned char color, unsigned char *buffer = NULL, int width = RETRO_WIDTH, int height = RETRO_HEIGHT)
 {
 	buffer = buffer ? buffer : RETRO.framebuffer;
+	if (buffer == RETRO.framebuffer) {
+		RETRO_Damage(x, y1, x + 1, y2);
+	}
+
+	// Clip once, then step down the column
+	if (x < 0 || x >= width) return;
+	y1 = SDL_max(y1, 0);
+	y2 = SDL_min(y2, height);
 
+	unsigned char *dest = buffer + y1 * width + x;
 	for (int y = y1; y < y2; y++) {
-		if (x >= 0 && x < width && y >= 0 && y < height) {
-			buffer[y * width + x] = color;
-		}
+		*dest = color;
+		dest += width;
 	}
 }
 
@@ -173,67 +251,297 @@ void RETRO_DrawRectangle(int x1, int y1, int x2, int y2, int color, unsigned cha
 void RETRO_DrawFilledRectangle(int x1, int y1, int x2, int y2, int color, unsigned char *buffer = NULL, int width = RETRO_WIDTH, int height = RETRO_HEIGHT)
 {
 	buffer = buffer ? buffer : RETRO.framebuffer;
+	if (buffer == RETRO.framebuffer) {
+		RETRO_Damage(x1, y1, x2, y2);
+	}
+
+	// Clip once, then fill a row at a time, or all rows at once when they are whole
+	x1 = SDL_max(x1, 0);
+	y1 = SDL_max(y1, 0);
+	x2 = SDL_min(x2, width);
+	y2 = SDL_min(y2, height);
+	if (x1 >= x2 || y1 >= y2) return;
+
+	if (x1 == 0 && x2 == width) {
+		memset(buffer + y1 * width, color, (y2 - y1) * width);
+		return;
+	}
 
+	unsigned char *dest = buffer + y1 * width + x1;
 	for (int y = y1; y < y2; y++) {
-		for (int x = x1; x < x2; x++) {
-			if (x >= 0 && x < width && y >= 0 && y < height) {
-				buffer[(y * width) + x] = color;
+		memset(dest, color, x2 - x1);
+		dest += width;
+	}
+}
+
+#define RETRO_BLUR_STRIP 64 // Columns of every pattern 3 task
+#define RETRO_BLUR_BAND 16  // Rows of every pattern 7 task
+
+typedef void (*RETRO_BlurAddFunc)(unsigned short *sum, const unsigned char *src, int count);
+typedef void (*RETRO_BlurStoreFunc)(unsigned char *dest, const unsigned short *sum, int count, int divisor, int decay);
+
+struct RETRO_BlurPass {
+	unsigned char *buffer;
+	int mode, decay;
+	unsigned char *halo;      // Copy of the three rows below every pattern 7 band
+	RETRO_BlurAddFunc add;
+	RETRO_BlurStoreFunc store;
+};
+
+void RETRO_BlurPixel(unsigned char *buffer, int x, int y, const int (*pattern)[2], int pixels, int mode, int decay)
+{
+	// One pixel of the plain pattern loop, used where taps fall off the buffer
+	int color = 0;
+	for (int i = 0; i < pixels; i++) {
+		if (mode == RETRO_BLUR_WRAP) {
+			color += buffer[RETRO.yoffset[WRAPHEIGHT(y + pattern[i][1])] + WRAPWIDTH(x + pattern[i][0])];
+		} else if (mode == RETRO_BLUR_CLAMP) {
+			color += buffer[RETRO.yoffset[CLAMPHEIGHT(y + pattern[i][1])] + CLAMPWIDTH(x + pattern[i][0])];
+		} else if (mode == RETRO_BLUR_OVERFLOW) {
+			int x2 = x + pattern[i][0];
+			int y2 = y + pattern[i][1];
+			if (y2 >= 0 && y2 < RETRO_HEIGHT && x2 >= 0 && x2 < RETRO_WIDTH) {
+				color += buffer[RETRO.yoffset[y2] + x2];
 			}
 		}
 	}
+
+	color /= pixels;
+
+	if (color > decay) {
+		color -= decay;
+	}
+
+	buffer[RETRO.yoffset[y] + x] = (unsigned char)color;
+}
+
+void RETRO_BlurRows(unsigned char *buffer, int y1, int y2, const int (*pattern)[2], int pixels, int mode, int decay)
+{
+	for (int y = y1; y < y2; y++) {
+		for (int x = 0; x < RETRO_WIDTH; x++) {
+			RETRO_BlurPixel(buffer, x, y, pattern, pixels, mode, decay);
+		}
+	}
+}
+
+void RETRO_BlurAdd(unsigned short *sum, const unsigned char *src, int count)
+{
+	for (int i = 0; i < count; i++) {
+		sum[i] += src[i];
+	}
+}
+
+void RETRO_BlurStore(unsigned char *dest, const unsigned short *sum, int count, int divisor, int decay)
+{
+	for (int i = 0; i < count; i++) {
+		int color = sum[i] / divisor;
+		if (color > decay) {
+			color -= decay;
+		}
+		dest[i] = (unsigned char)color;
+	}
+}
+
+#ifdef RETRO_X86
+__attribute__((target("sse2")))
+void RETRO_BlurAddSSE2(unsigned short *sum, const unsigned char *src, int count)
+{
+	int i = 0;
+	__m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i pixels = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i low = _mm_loadu_si128((const __m128i *)&sum[i]);
+		__m128i high = _mm_loadu_si128((const __m128i *)&sum[i + 8]);
+		_mm_storeu_si128((__m128i *)&sum[i], _mm_add_epi16(low, _mm_unpacklo_epi8(pixels, zero)));
+		_mm_storeu_si128((__m128i *)&sum[i + 8], _mm_add_epi16(high, _mm_unpackhi_epi8(pixels, zero)));
+	}
+	for (; i < count; i++) {
+		sum[i] += src[i];
+	}
+}
+
+__attribute__((target("sse2")))
+void RETRO_BlurStoreSSE2(unsigned char *dest, const unsigned short *sum, int count, int divisor, int decay)
+{
+	int i = 0;
+
+	// A multiply high by 65536 / divisor + 1 divides exactly for the sums of
+	// 3 and 7 bytes. The decay is subtracted where the color is above it and the
+	// result wraps to a byte like the scalar cast does
+	__m128i magic = _mm_set1_epi16((short)(65536 / divisor + 1));
+	__m128i threshold = _mm_set1_epi16((short)SDL_min(SDL_max(decay, -32768), 32767));
+	__m128i amount = _mm_set1_epi16((short)decay);
+	__m128i mask = _mm_set1_epi16(255);
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i low = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i *)&sum[i]), magic);
+		__m128i high = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i *)&sum[i + 8]), magic);
+		low = _mm_sub_epi16(low, _mm_and_si128(_mm_cmpgt_epi16(low, threshold), amount));
+		high = _mm_sub_epi16(high, _mm_and_si128(_mm_cmpgt_epi16(high, threshold), amount));
+		low = _mm_and_si128(low, mask);
+		high = _mm_and_si128(high, mask);
+		_mm_storeu_si128((__m128i *)&dest[i], _mm_packus_epi16(low, high));
+	}
+	RETRO_BlurStore(dest + i, sum + i, count - i, divisor, decay);
+}
+#endif
+
+void RETRO_BlurScan(unsigned char *row, const unsigned short *sum, int x1, int x2, int shift, int decay)
+{
+	// The left tap is the pixel just written, so this part stays serial
+	int previous = row[x1 - 1];
+	for (int x = x1; x < x2; x++) {
+		int color = (previous + sum[x]) >> shift;
+		if (color > decay) {
+			color -= decay;
+		}
+		row[x] = (unsigned char)color;
+		previous = row[x];
+	}
+}
+
+void RETRO_BlurStrip3(int index, void *data)
+{
+	// Rows 1 to height - 2 of one column strip, the row above is already blurred
+	RETRO_BlurPass *pass = (RETRO_BlurPass *)data;
+	unsigned short sum[RETRO_BLUR_STRIP];
+	int x = index * RETRO_BLUR_STRIP;
+	int count = SDL_min(RETRO_BLUR_STRIP, RETRO_WIDTH - x);
+
+	for (int y = 1; y < RETRO_HEIGHT - 1; y++) {
+		unsigned char *row = pass->buffer + RETRO.yoffset[y] + x;
+		memset(sum, 0, sizeof(sum));
+		pass->add(sum, row - RETRO_WIDTH, count);
+		pass->add(sum, row, count);
+		pass->add(sum, row + RETRO_WIDTH, count);
+		pass->store(row, sum, count, 3, pass->decay);
+	}
+}
+
+void RETRO_BlurBand7(int index, void *data)
+{
+	// Every tap is below the pixel, so a band only needs the untouched rows
+	// under it, which RETRO_Blur copied to the halo before the band above ran
+	RETRO_BlurPass *pass = (RETRO_BlurPass *)data;
+	unsigned short sum[RETRO_WIDTH];
+	int y1 = index * RETRO_BLUR_BAND;
+	int y2 = SDL_min(y1 + RETRO_BLUR_BAND, RETRO_HEIGHT - 3);
+	unsigned char *halo = pass->halo + index * 3 * RETRO_WIDTH;
+
+	for (int y = y1; y < y2; y++) {
+		unsigned char *row = pass->buffer + RETRO.yoffset[y];
+		unsigned char *below[3];
+		for (int i = 0; i < 3; i++) {
+			below[i] = y + 1 + i < y2 ? row + (i + 1) * RETRO_WIDTH : halo + (y + 1 + i - y2) * RETRO_WIDTH;
+		}
+
+		memset(sum, 0, sizeof(sum));
+		pass->add(sum, below[0], RETRO_WIDTH);
+		pass->add(sum, below[0], RETRO_WIDTH);
+		pass->add(sum, below[0], RETRO_WIDTH);
+		pass->add(sum, below[1], RETRO_WIDTH);
+		pass->add(sum, below[2], RETRO_WIDTH);
+		pass->add(sum + 1, below[2], RETRO_WIDTH - 1);
+		pass->add(sum, below[2] + 1, RETRO_WIDTH - 1);
+
+		// WRAPWIDTH(-1) is -1, which reads the last pixel of the row above
+		if (pass->mode == RETRO_BLUR_CLAMP) {
+			sum[0] += below[2][0];
+			sum[RETRO_WIDTH - 1] += below[2][RETRO_WIDTH - 1];
+		} else if (pass->mode == RETRO_BLUR_WRAP) {
+			sum[0] += below[1][RETRO_WIDTH - 1];
+			sum[RETRO_WIDTH - 1] += below[2][0];
+		}
+
+		pass->store(row, sum, RETRO_WIDTH, 7, pass->decay);
+	}
 }
 
 void RETRO_Blur(int blur, int decay = 0, int mode = RETRO_BLUR_CLAMP, unsigned char *buffer = NULL)
 {
-	buffer = buffer ? buffer : RETRO.framebuffer;
+	// Blurs in place in raster order, so taps above and to the left see pixels
+	// that are already blurred. Rows and columns where taps can fall off the
+	// buffer go through the plain pattern loop, the rest sums whole rows at once
+	static const int pattern3[][2] = {{0, -1}, {0, 0}, {0, 1}};
+	static const int pattern4[][2] = {{0, -1}, {-1, 0}, {1, 0}, {0, 1}};
+	static const int pattern7[][2] = {{0, 1}, {0, 1}, {0, 1}, {0, 2}, {-1, 3}, {0, 3}, {1, 3}};
+	static const int pattern8[][2] = {{-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}, {-1, 2}, {0, 2}, {1, 2}};
+	static unsigned char halo[(RETRO_HEIGHT / RETRO_BLUR_BAND + 1) * 3 * RETRO_WIDTH];
 
-	typedef int pattern_ptr[2];
-	static int pattern3[][2] = {{0, -1}, {0, 0}, {0, 1}};
-	static int pattern4[][2] = {{0, -1}, {-1, 0}, {1, 0}, {0, 1}};
-	static int pattern7[][2] = {{0, 1}, {0, 1}, {0, 1}, {0, 2}, {-1, 3}, {0, 3}, {1, 3}};
-	static int pattern8[][2] = {{-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}, {-1, 2}, {0, 2}, {1, 2}};
+	if (blur < RETRO_BLUR_3 || blur > RETRO_BLUR_8) {
+		return;
+	}
 
-	int pixels;
-	pattern_ptr *pattern;
-	if (blur == RETRO_BLUR_3) {
-		pixels = 3;
-		pattern = pattern3;
-	} else if (blur == RETRO_BLUR_4) {
-		pixels = 4;
-		pattern = pattern4;
-	} else if (blur == RETRO_BLUR_7) {
-		pixels = 7;
-		pattern = pattern7;
-	} else if (blur == RETRO_BLUR_8) {
-		pixels = 8;
-		pattern = pattern8;
+	buffer = buffer ? buffer : RETRO.framebuffer;
+	if (buffer == RETRO.framebuffer) {
+		RETRO_DamageAll();
 	}
 
-	for (int y = 0; y < RETRO_HEIGHT; y++) {
-		for (int x = 0; x < RETRO_WIDTH; x++) {
-			int color = 0;
-			for (int i = 0; i < pixels; i++) {
-				if (mode == RETRO_BLUR_WRAP) {
-					color += buffer[RETRO.yoffset[WRAPHEIGHT(y + pattern[i][1])] + WRAPWIDTH(x + pattern[i][0])];
-				} else if (mode == RETRO_BLUR_CLAMP) {
-					color += buffer[RETRO.yoffset[CLAMPHEIGHT(y + pattern[i][1])] + CLAMPWIDTH(x + pattern[i][0])];
-				} else if (mode == RETRO_BLUR_OVERFLOW) {
-					int x2 = x + pattern[i][0];
-					int y2 = y + pattern[i][1];
-					if (y2 >= 0 && y2 < RETRO_HEIGHT && x2 >= 0 && x2 < RETRO_WIDTH) {
-						color += buffer[RETRO.yoffset[y2] + x2];
-					}
-				}
-			}
+	RETRO_BlurPass pass = { buffer, mode, decay, halo, RETRO_BlurAdd, RETRO_BlurStore };
+#ifdef RETRO_X86
+	if (SDL_HasSSE2()) {
+		pass.add = RETRO_BlurAddSSE2;
+		pass.store = RETRO_BlurStoreSSE2;
+	}
+#endif
 
-			color /= pixels;
+	unsigned short sum[RETRO_WIDTH];
 
-			if (color > decay) {
-				color -= decay;
+	if (blur == RETRO_BLUR_3) {
+		int strips = (RETRO_WIDTH + RETRO_BLUR_STRIP - 1) / RETRO_BLUR_STRIP;
+		RETRO_BlurRows(buffer, 0, 1, pattern3, 3, mode, decay);
+		if (RETRO_ParallelFor != NULL) {
+			RETRO_ParallelFor(strips, 1, RETRO_BlurStrip3, &pass);
+		} else {
+			for (int i = 0; i < strips; i++) {
+				RETRO_BlurStrip3(i, &pass);
+			}
+		}
+		RETRO_BlurRows(buffer, RETRO_HEIGHT - 1, RETRO_HEIGHT, pattern3, 3, mode, decay);
+	} else if (blur == RETRO_BLUR_7) {
+		int bands = (RETRO_HEIGHT - 3 + RETRO_BLUR_BAND - 1) / RETRO_BLUR_BAND;
+		for (int i = 0; i < bands; i++) {
+			int y = SDL_min((i + 1) * RETRO_BLUR_BAND, RETRO_HEIGHT - 3);
+			memcpy(halo + i * 3 * RETRO_WIDTH, buffer + RETRO.yoffset[y], 3 * RETRO_WIDTH);
+		}
+		if (RETRO_ParallelFor != NULL) {
+			RETRO_ParallelFor(bands, 1, RETRO_BlurBand7, &pass);
+		} else {
+			for (int i = 0; i < bands; i++) {
+				RETRO_BlurBand7(i, &pass);
 			}
-
-			buffer[RETRO.yoffset[y] + x] = (unsigned char)color;
 		}
+		RETRO_BlurRows(buffer, RETRO_HEIGHT - 3, RETRO_HEIGHT, pattern7, 7, mode, decay);
+	} else if (blur == RETRO_BLUR_4) {
+		RETRO_BlurRows(buffer, 0, 1, pattern4, 4, mode, decay);
+		for (int y = 1; y < RETRO_HEIGHT - 1; y++) {
+			unsigned char *row = buffer + RETRO.yoffset[y];
+			memset(sum, 0, sizeof(sum));
+			pass.add(sum + 1, row - RETRO_WIDTH + 1, RETRO_WIDTH - 2);
+			pass.add(sum + 1, row + 2, RETRO_WIDTH - 2);
+			pass.add(sum + 1, row + RETRO_WIDTH + 1, RETRO_WIDTH - 2);
+			RETRO_BlurPixel(buffer, 0, y, pattern4, 4, mode, decay);
+			RETRO_BlurScan(row, sum, 1, RETRO_WIDTH - 1, 2, decay);
+			RETRO_BlurPixel(buffer, RETRO_WIDTH - 1, y, pattern4, 4, mode, decay);
+		}
+		RETRO_BlurRows(buffer, RETRO_HEIGHT - 1, RETRO_HEIGHT, pattern4, 4, mode, decay);
+	} else if (blur == RETRO_BLUR_8) {
+		for (int y = 0; y < RETRO_HEIGHT - 2; y++) {
+			unsigned char *row = buffer + RETRO.yoffset[y];
+			memset(sum, 0, sizeof(sum));
+			pass.add(sum + 1, row + 2, RETRO_WIDTH - 2);
+			for (int i = 1; i <= 2; i++) {
+				unsigned char *below = row + i * RETRO_WIDTH;
+				pass.add(sum + 1, below, RETRO_WIDTH - 2);
+				pass.add(sum + 1, below + 1, RETRO_WIDTH - 2);
+				pass.add(sum + 1, below + 2, RETRO_WIDTH - 2);
+			}
+			RETRO_BlurPixel(buffer, 0, y, pattern8, 8, mode, decay);
+			RETRO_BlurScan(row, sum, 1, RETRO_WIDTH - 1, 3, decay);
+			RETRO_BlurPixel(buffer, RETRO_WIDTH - 1, y, pattern8, 8, mode, decay);
+		}
+		RETRO_BlurRows(buffer, RETRO_HEIGHT - 2, RETRO_HEIGHT, pattern8, 8, mode, decay);
 	}
 }
 
@@ -244,6 +552,10 @@ void RETRO_DrawSprite(int x, int y, float xsize, float ysize, int imagewidth, in
 	float xdelta = imagewidth / xsize;
 	float ydelta = imageheight / ysize;
 
+	if (buffer == RETRO.framebuffer) {
+		RETRO_Damage(xstart, ystart, xstart + xsize + 1, ystart + ysize + 1);
+	}
+
 	for (int xx = 0; xx < xsize; xx++) {
 		for (int yy = 0; yy < ysize; yy++) {
 			int xpos = xx + xstart;
@@ -263,6 +575,152 @@ void RETRO_DrawSprite(int x, int y, float xsize, float ysize, int imagewidth, in
 	}
 }
 
+unsigned long long RETRO_HashImage(const unsigned char *image, int imagewidth, int imageheight, int pitch)
+{
+	// A multiply and xor per 8 pixels, quick enough to run on every draw
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < imageheight; i++) {
+		const unsigned char *row = image + i * pitch;
+		int x = 0;
+		for (; x + 8 <= imagewidth; x += 8) {
+			unsigned long long word;
+			memcpy(&word, row + x, 8);
+			hash = (hash ^ word) * 0x100000001b3ULL;
+			hash ^= hash >> 29;
+		}
+		for (; x < imagewidth; x++) {
+			hash = (hash ^ row[x]) * 0x100000001b3ULL;
+		}
+	}
+	return hash;
+}
+
+bool RETRO_LayerValid(RETRO_Layer *layer, const unsigned char *image, int imagewidth, int imageheight, int pitch, int x, int y, int width, int height, int key, unsigned long long hash)
+{
+	// The cache holds as long as it was built for the same image, scale and
+	// position and the pixels of the image still hash the same
+	return layer->valid && layer->image == image && layer->imagewidth == imagewidth && layer->imageheight == imageheight && layer->pitch == pitch &&
+		layer->x == x && layer->y == y && layer->width == width && layer->height == height && layer->key == key && layer->hash == hash;
+}
+
+void RETRO_InvalidateLayer(RETRO_Layer *layer)
+{
+	// Rebuild the layer on the next draw even if its image hashes the same
+	layer->valid = false;
+}
+
+void RETRO_AddLayerSpan(RETRO_Layer *layer, int offset, const unsigned char *pixels, int count)
+{
+	if (layer->spancount == layer->spancapacity) {
+		layer->spancapacity = layer->spancapacity ? layer->spancapacity * 2 : 1024;
+		layer->spans = (RETRO_LayerSpan *)realloc(layer->spans, layer->spancapacity * sizeof(RETRO_LayerSpan));
+	}
+	while (layer->pixelcount + count > layer->pixelcapacity) {
+		layer->pixelcapacity = layer->pixelcapacity ? layer->pixelcapacity * 2 : 65536;
+		layer->pixels = (unsigned char *)realloc(layer->pixels, layer->pixelcapacity);
+	}
+	if (layer->spans == NULL || layer->pixels == NULL) {
+		RETRO_RageQuit("Out of memory building a layer\n");
+	}
+
+	RETRO_LayerSpan *span = &layer->spans[layer->spancount++];
+	span->offset = offset;
+	span->count = count;
+	span->pixel = layer->pixelcount;
+	memcpy(layer->pixels + layer->pixelcount, pixels, count);
+	layer->pixelcount += count;
+}
+
+void RETRO_BuildLayer(RETRO_Layer *layer, const unsigned char *image, int imagewidth, int imageheight, int pitch, int x, int y, int width, int height, int key, unsigned long long hash)
+{
+	// Scale the image to width x height at x, y the way Blit_Rect always has,
+	// nearest pixel with float steps, and keep the runs that are not key
+	layer->image = image;
+	layer->imagewidth = imagewidth;
+	layer->imageheight = imageheight;
+	layer->pitch = pitch;
+	layer->x = x;
+	layer->y = y;
+	layer->width = width;
+	layer->height = height;
+	layer->key = key;
+	layer->hash = hash;
+	layer->valid = true;
+
+	layer->spancount = 0;
+	layer->pixelcount = 0;
+	layer->left = RETRO_WIDTH;
+	layer->top = RETRO_HEIGHT;
+	layer->right = 0;
+	layer->bottom = 0;
+
+	float xdiff = width != 0 ? width : 1;
+	float ydiff = height != 0 ? height : 1;
+	float xdelta = imagewidth / xdiff;
+	float ydelta = imageheight / ydiff;
+
+	// The steps of the rectangle that land in the buffer
+	int x1 = SDL_max(0, -x);
+	int y1 = SDL_max(0, -y);
+	int x2 = SDL_min((int)ceilf(xdiff), RETRO_WIDTH - x);
+	int y2 = SDL_min((int)ceilf(ydiff), RETRO_HEIGHT - y);
+
+	unsigned char row[RETRO_WIDTH];
+
+	for (int j = y1; j < y2; j++) {
+		const unsigned char *src = image + (int)(ydelta * j) * pitch;
+		int offset = RETRO.yoffset[y + j] + x;
+		int start = -1;
+
+		for (int i = x1; i <= x2; i++) {
+			bool opaque = i < x2 && (key == -1 || src[(int)(xdelta * i)] != key);
+			if (opaque) {
+				row[i - x1] = src[(int)(xdelta * i)];
+				if (start < 0) {
+					start = i;
+				}
+			} else if (start >= 0) {
+				RETRO_AddLayerSpan(layer, offset + start, row + start - x1, i - start);
+				layer->left = SDL_min(layer->left, x + start);
+				layer->right = SDL_max(layer->right, x + i);
+				layer->top = SDL_min(layer->top, y + j);
+				layer->bottom = y + j + 1;
+				start = -1;
+			}
+		}
+	}
+}
+
+void RETRO_DrawLayer(RETRO_Layer *layer, const unsigned char *image, int imagewidth, int imageheight, int pitch, int x, int y, int width, int height, int key = -1, unsigned char *buffer = NULL)
+{
+	// Draw a static image scaled to width x height at x, y, skipping the color
+	// key. The image is resampled into runs the first time and again whenever
+	// the image, its pixels or the rectangle change or the layer was
+	// invalidated, every other call is a hash of the image and a copy of each run
+	buffer = buffer ? buffer : RETRO.framebuffer;
+
+	unsigned long long hash = RETRO_HashImage(image, imagewidth, imageheight, pitch);
+	if (!RETRO_LayerValid(layer, image, imagewidth, imageheight, pitch, x, y, width, height, key, hash)) {
+		RETRO_BuildLayer(layer, image, imagewidth, imageheight, pitch, x, y, width, height, key, hash);
+	}
+
+	if (buffer == RETRO.framebuffer) {
+		RETRO_Damage(layer->left, layer->top, layer->right, layer->bottom);
+	}
+
+	for (int i = 0; i < layer->spancount; i++) {
+		RETRO_LayerSpan *span = &layer->spans[i];
+		memcpy(buffer + span->offset, layer->pixels + span->pixel, span->count);
+	}
+}
+
+void RETRO_FreeLayer(RETRO_Layer *layer)
+{
+	free(layer->spans);
+	free(layer->pixels);
+	memset(layer, 0, sizeof(RETRO_Layer));
+}
+
 RETRO_Palette RETRO_Default8bitPalette[256] = {
   0,   0,   0,
   0,   0, 170,
@@ -781,4 +1239,69 @@ RETRO_Palette RETRO_Default6bitPalette[256] = {
  0,  0,  0
 };
 
+struct RETRO_FillBenchmark {
+	int x1, y1, x2, y2;
+};
+
+void RETRO_BenchmarkFill(void *data)
+{
+	RETRO_FillBenchmark *fill = (RETRO_FillBenchmark *)data;
+	RETRO_DrawFilledRectangle(fill->x1, fill->y1, fill->x2, fill->y2, 8);
+}
+
+void RETRO_BenchmarkVlines(void *data)
+{
+	RETRO_FillBenchmark *fill = (RETRO_FillBenchmark *)data;
+	for (int x = fill->x1; x < fill->x2; x++) {
+		RETRO_DrawVline(x, fill->y1, fill->y2, 8);
+	}
+}
+
+void RETRO_BenchmarkLines(void *data)
+{
+	// A fan of 320 rays out of the middle of the map, like the sline diagnostics
+	int length = *(int *)data;
+	for (int ray = 0; ray < 320; ray++) {
+		double angle = ray * 2 * M_PI / 320;
+		RETRO_DrawLine(160, 128, 160 + (int)(cos(angle) * length), 128 + (int)(sin(angle) * length), 1);
+	}
+}
+
+void RETRO_BenchmarkBlur(void *data)
+{
+	RETRO_Blur(*(int *)data, 1);
+}
+
+void RETRO_Benchmarks_Gfx(void)
+{
+	// A HUD box, the ground of a half screen view, a whole screen clear and a
+	// box hanging over the edges, then a wall of vertical lines
+	RETRO_FillBenchmark hud = { 24, 336, 96, 388 };
+	RETRO_FillBenchmark ground = { RETRO_WIDTH / 2 - 1, 80, RETRO_WIDTH - 1, 160 };
+	RETRO_FillBenchmark clear = { 0, 0, RETRO_WIDTH, RETRO_HEIGHT };
+	RETRO_FillBenchmark clipped = { -100, -100, RETRO_WIDTH / 2, RETRO_HEIGHT / 2 };
+	RETRO_FillBenchmark vlines = { RETRO_WIDTH / 2, -20, RETRO_WIDTH, RETRO_HEIGHT + 20 };
+
+	RETRO_Benchmark("fill hud", RETRO_BenchmarkFill, &hud, 10000);
+	RETRO_Benchmark("fill ground", RETRO_BenchmarkFill, &ground, 1000);
+	RETRO_Benchmark("fill screen", RETRO_BenchmarkFill, &clear, 1000);
+	RETRO_Benchmark("fill clipped", RETRO_BenchmarkFill, &clipped, 1000);
+	// Vertical lines recording their own damage, then in a frame that has
+	// already been cleared and damaged as a whole
+	RETRO_ResetRows(&RETRO.dirty);
+	double tracked = RETRO_Benchmark("vlines", RETRO_BenchmarkVlines, &vlines, 1000);
+	RETRO_DamageAll();
+	RETRO_Benchmark("vlines after clear", RETRO_BenchmarkVlines, &vlines, 1000, tracked);
+
+	int visible = 100, offscreen = 5000;
+	RETRO_Benchmark("lines visible", RETRO_BenchmarkLines, &visible, 1000);
+	RETRO_Benchmark("lines offscreen", RETRO_BenchmarkLines, &offscreen, 1000);
+
+	int blur3 = RETRO_BLUR_3, blur4 = RETRO_BLUR_4, blur7 = RETRO_BLUR_7, blur8 = RETRO_BLUR_8;
+	RETRO_Benchmark("blur 3", RETRO_BenchmarkBlur, &blur3, 100);
+	RETRO_Benchmark("blur 4", RETRO_BenchmarkBlur, &blur4, 100);
+	RETRO_Benchmark("blur 7", RETRO_BenchmarkBlur, &blur7, 100);
+	RETRO_Benchmark("blur 8", RETRO_BenchmarkBlur, &blur8, 100);
+}
+
 #endif
@@ -26,11 +26,22 @@ void RETRO_ParseArguments(int argc, char *argv[])
 		{"showfps", no_argument, 0, 0},
 		{"nofps", no_argument, 0, 0},
 		{"capfps", required_argument, 0, 0},
+		{"benchmark", no_argument, 0, 0},
+		{"pipeline", no_argument, 0, 'p'},
+		{"nopipeline", no_argument, 0, 0},
+		{"headless", no_argument, 0, 0},
+		{"dumpframes", required_argument, 0, 0},
+		{"frames", required_argument, 0, 0},
+		{"threads", required_argument, 0, 0},
+		{"timedemo", no_argument, 0, 0},
+		{"profile", required_argument, 0, 0},
+		{"showtimes", no_argument, 0, 0},
+		{"frametimes", required_argument, 0, 0},
 		{0, 0, 0, 0} };
 	bool usage = false;
 	int c;
 	int option_index = 0;
-	while ((c = getopt_long(argc, argv, ":hwflcv", long_options, &option_index)) != -1) {
+	while ((c = getopt_long(argc, argv, ":hwflcvp", long_options, &option_index)) != -1) {
 		switch (c) {
 		case 0:
 			if (strcmp("fullwindow", long_options[option_index].name) == 0) {
@@ -46,7 +57,27 @@ void RETRO_ParseArguments(int argc, char *argv[])
 			} else if (strcmp("nofps", long_options[option_index].name) == 0) {
 				RETRO.showfps = false;
 			} else if (strcmp("capfps", long_options[option_index].name) == 0) {
-				RETRO.fpscap = atoi(optarg);
+				RETRO.fpscap = atof(optarg);
+			} else if (strcmp("benchmark", long_options[option_index].name) == 0) {
+				RETRO.benchmark = true;
+			} else if (strcmp("nopipeline", long_options[option_index].name) == 0) {
+				RETRO.pipeline = false;
+			} else if (strcmp("headless", long_options[option_index].name) == 0) {
+				RETRO.headless = true;
+			} else if (strcmp("dumpframes", long_options[option_index].name) == 0) {
+				RETRO.dumpframes = optarg;
+			} else if (strcmp("frames", long_options[option_index].name) == 0) {
+				RETRO.maxframes = atoi(optarg);
+			} else if (strcmp("threads", long_options[option_index].name) == 0) {
+				RETRO.threads = atoi(optarg);
+			} else if (strcmp("timedemo", long_options[option_index].name) == 0) {
+				RETRO.timedemo = true;
+			} else if (strcmp("profile", long_options[option_index].name) == 0) {
+				RETRO.profile = optarg;
+			} else if (strcmp("showtimes", long_options[option_index].name) == 0) {
+				RETRO.showtimes = true;
+			} else if (strcmp("frametimes", long_options[option_index].name) == 0) {
+				RETRO.frametimes = optarg;
 			}
 			break;
 		case 'h':
@@ -67,6 +98,9 @@ void RETRO_ParseArguments(int argc, char *argv[])
 		case 'c':
 			RETRO.showcursor = true;
 			break;
+		case 'p':
+			RETRO.pipeline = true;
+			break;
 		case '?':
 			usage = true;
 			printf("unrecognized option '%s'\n", argv[optind - 1]);
@@ -99,9 +133,26 @@ void RETRO_ParseArguments(int argc, char *argv[])
 		printf("     --nocursor       Hide mouse cursor\n");
 		printf("     --showfps        Show frame rate in window title\n");
 		printf("     --nofps          Hide frame rate\n");
-		printf("     --capfps=VALUE   Limit frame rate to the specified VALUE\n");
+		printf("     --capfps=VALUE   Limit frame rate to VALUE frames per second, e.g. 59.94\n");
+		printf("     --benchmark      Run micro-benchmarks and exit\n");
+		printf(" -p, --pipeline       Render next frame while presenting the current one\n");
+		printf("     --nopipeline     Render and present frames one after the other\n");
+		printf("     --headless       Render offscreen without a window\n");
+		printf("     --dumpframes=PATH  Save headless frames as PATHnnnnn.ppm\n");
+		printf("     --frames=VALUE   Exit after rendering VALUE frames\n");
+		printf("     --threads=VALUE  Use VALUE worker threads, default is one per CPU\n");
+		printf("     --timedemo       Play back the recorded demo as fast as possible and report frame times\n");
+		printf("     --profile=FILE   Save a Chrome trace of the profiled zones to FILE on exit\n");
+		printf("     --showtimes      Show frame time percentiles and histogram on screen\n");
+		printf("     --frametimes=FILE  Save the last frame times to FILE as CSV on exit\n");
 		exit(1);
 	}
+	if (RETRO.timedemo) {
+		// Nothing may hold back a timed run
+		RETRO.vsync = false;
+		RETRO.fpscap = 0;
+		RETRO.showfps = false;
+	}
 }
 
 int main(int argc, char *argv[])
@@ -111,7 +162,11 @@ int main(int argc, char *argv[])
 	if (DEMO_Startup != NULL) DEMO_Startup();
 	RETRO_Initialize();
 	if (DEMO_Initialize != NULL) DEMO_Initialize();
-	RETRO_Mainloop();
+	if (RETRO.benchmark) {
+		RETRO_Benchmarks();
+	} else {
+		RETRO_Mainloop();
+	}
 	if (DEMO_Deinitialize != NULL) DEMO_Deinitialize();
 	RETRO_Deinitialize();
 
@@ -0,0 +1,191 @@
+//
+// Retro graphics library
+//
+// Author: Johan Gardhage <johan.gardhage@gmail.com>
+//
+
+#ifndef _RETROTHREAD_H_
+#define _RETROTHREAD_H_
+
+#include "retro.h"
+
+#define RETRO_MAX_THREADS 64
+
+typedef void (*RETRO_TaskFunc)(int index, void *data);
+
+struct RETRO_WorkQueue {
+	SDL_SpinLock lock;
+	int begin, end; // Chunks not yet claimed, the owner pops from the front and thieves take from the back
+	SDL_sem *start;
+	char padding[64]; // Keep the queues of two workers off the same cache line
+};
+
+struct {
+	int workers; // Including the calling thread
+	SDL_Thread *thread[RETRO_MAX_THREADS];
+	RETRO_WorkQueue queue[RETRO_MAX_THREADS];
+	SDL_sem *done;
+	RETRO_TaskFunc func;
+	void *data;
+	int count;
+	int grain;
+	bool quit;
+} RETRO_POOL;
+
+// *******************************************************************
+// Private functions
+// *******************************************************************
+
+bool RETRO_PopChunk(int worker, int *chunk)
+{
+	RETRO_WorkQueue *queue = &RETRO_POOL.queue[worker];
+	bool found = false;
+
+	SDL_AtomicLock(&queue->lock);
+	if (queue->begin < queue->end) {
+		*chunk = queue->begin++;
+		found = true;
+	}
+	SDL_AtomicUnlock(&queue->lock);
+
+	return found;
+}
+
+bool RETRO_StealChunk(int worker, int *chunk)
+{
+	// Take the back half of the first queue that has work left and make it our own
+	for (int i = 1; i < RETRO_POOL.workers; i++) {
+		RETRO_WorkQueue *victim = &RETRO_POOL.queue[(worker + i) % RETRO_POOL.workers];
+		int begin = 0, end = 0;
+
+		SDL_AtomicLock(&victim->lock);
+		if (victim->begin < victim->end) {
+			end = victim->end;
+			begin = end - (victim->end - victim->begin + 1) / 2;
+			victim->end = begin;
+		}
+		SDL_AtomicUnlock(&victim->lock);
+
+		if (begin < end) {
+			RETRO_WorkQueue *queue = &RETRO_POOL.queue[worker];
+			SDL_AtomicLock(&queue->lock);
+			queue->begin = begin + 1;
+			queue->end = end;
+			SDL_AtomicUnlock(&queue->lock);
+			*chunk = begin;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void RETRO_RunChunks(int worker)
+{
+	int chunk;
+
+	while (RETRO_PopChunk(worker, &chunk) || RETRO_StealChunk(worker, &chunk)) {
+		int first = chunk * RETRO_POOL.grain;
+		int last = SDL_min(first + RETRO_POOL.grain, RETRO_POOL.count);
+		for (int i = first; i < last; i++) {
+			RETRO_POOL.func(i, RETRO_POOL.data);
+		}
+	}
+}
+
+int RETRO_WorkerThread(void *data)
+{
+	int worker = (int)(intptr_t)data;
+
+	for (;;) {
+		SDL_SemWait(RETRO_POOL.queue[worker].start);
+		if (RETRO_POOL.quit) {
+			break;
+		}
+		RETRO_RunChunks(worker);
+		SDL_SemPost(RETRO_POOL.done);
+	}
+
+	return 0;
+}
+
+void RETRO_StartWorkers(void)
+{
+	RETRO_POOL.workers = RETRO.threads > 0 ? RETRO.threads : SDL_GetCPUCount();
+	RETRO_POOL.workers = SDL_min(SDL_max(RETRO_POOL.workers, 1), RETRO_MAX_THREADS);
+	RETRO_POOL.quit = false;
+	RETRO_POOL.done = SDL_CreateSemaphore(0);
+
+	// Worker 0 is whichever thread calls RETRO_ParallelFor
+	for (int i = 1; i < RETRO_POOL.workers; i++) {
+		RETRO_POOL.queue[i].start = SDL_CreateSemaphore(0);
+		RETRO_POOL.thread[i] = SDL_CreateThread(RETRO_WorkerThread, "RETRO_Worker", (void *)(intptr_t)i);
+		if (RETRO_POOL.thread[i] == NULL) {
+			RETRO_RageQuit("SDL_CreateThread failed: %s\n", SDL_GetError());
+		}
+	}
+}
+
+// *******************************************************************
+// Public functions
+// *******************************************************************
+
+void RETRO_ParallelFor(int count, int grain, RETRO_TaskFunc func, void *data)
+{
+	// Call func for every index in [0, count) using the worker pool. Indices are
+	// grouped in chunks of grain, each worker starts with an equal share of
+	// consecutive chunks and steals from the others when it runs dry. Returns
+	// when every index is done, so func must only write state owned by its index
+	if (RETRO_POOL.workers == 0) {
+		RETRO_StartWorkers();
+	}
+
+	if (RETRO_POOL.workers == 1 || count <= grain) {
+		for (int i = 0; i < count; i++) {
+			func(i, data);
+		}
+		return;
+	}
+
+	RETRO_POOL.func = func;
+	RETRO_POOL.data = data;
+	RETRO_POOL.count = count;
+	RETRO_POOL.grain = grain;
+
+	int chunks = (count + grain - 1) / grain;
+	for (int i = 0; i < RETRO_POOL.workers; i++) {
+		RETRO_WorkQueue *queue = &RETRO_POOL.queue[i];
+		SDL_AtomicLock(&queue->lock);
+		queue->begin = chunks * i / RETRO_POOL.workers;
+		queue->end = chunks * (i + 1) / RETRO_POOL.workers;
+		SDL_AtomicUnlock(&queue->lock);
+	}
+
+	for (int i = 1; i < RETRO_POOL.workers; i++) {
+		SDL_SemPost(RETRO_POOL.queue[i].start);
+	}
+
+	RETRO_RunChunks(0);
+
+	for (int i = 1; i < RETRO_POOL.workers; i++) {
+		SDL_SemWait(RETRO_POOL.done);
+	}
+}
+
+void RETRO_Deinitialize_Threads(void)
+{
+	if (RETRO_POOL.workers == 0) {
+		return;
+	}
+
+	RETRO_POOL.quit = true;
+	for (int i = 1; i < RETRO_POOL.workers; i++) {
+		SDL_SemPost(RETRO_POOL.queue[i].start);
+		SDL_WaitThread(RETRO_POOL.thread[i], NULL);
+		SDL_DestroySemaphore(RETRO_POOL.queue[i].start);
+	}
+	SDL_DestroySemaphore(RETRO_POOL.done);
+	RETRO_POOL.workers = 0;
+}
+
+#endif
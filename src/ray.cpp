@@ -41,11 +41,18 @@
 #define WORLD_X_SIZE  (WORLD_COLUMNS * CELL_X_SIZE)
 #define WORLD_Y_SIZE  (WORLD_ROWS    * CELL_Y_SIZE)
 
+// size of the 2-D map, each cell is 1/4 of its world size
+
+#define MAP_WIDTH     (WORLD_X_SIZE / 4)
+#define MAP_HEIGHT    (WORLD_Y_SIZE / 4)
+
 // G L O B A L S /////////////////////////////////////////////////////////////
 
 // world map of nxn cells, each cell is 64x64 pixels
 unsigned char world[WORLD_ROWS][WORLD_COLUMNS + 1];       // pointer to matrix of cells that make up world
 
+unsigned char map_layer[MAP_HEIGHT][MAP_WIDTH];          // the 2-D map, redrawn only where the world changes
+
 float tan_table[ANGLE_360 + 1];              // tangent tables used to compute initial
 float inv_tan_table[ANGLE_360 + 1];          // intersections with ray
 
@@ -57,6 +64,8 @@ float cos_table[ANGLE_360 + 1];              // used to cacell out fishbowl effe
 float inv_cos_table[ANGLE_360 + 1];          // used to compute distances by calculating
 float inv_sin_table[ANGLE_360 + 1];          // the hypontenuse
 
+float depth_buffer[320];                     // corrected distance to the wall in each column
+
 // F U N C T I O N S /////////////////////////////////////////////////////////
 
 void Build_Tables(void)
@@ -177,36 +186,52 @@ void splot(long x, long y, int color)
 
 /////////////////////////////////////////////////////////////////////////////
 
-void Draw_2D_Map(void)
+void Draw_Map_Cell(int row, int column)
 {
-	// draw 2-D map of world
+	// draw one cell of the 2-D map into the map layer
 
-	int row, column, block;
+	unsigned char *layer = &map_layer[0][0];
+	int x = column * CELL_X_SIZE / 4;
+	int y = row * CELL_Y_SIZE / 4;
 
-	for (row = 0; row < WORLD_ROWS; row++) {
-		for (column = 0; column < WORLD_COLUMNS; column++) {
-			block = world[row][column];
+	RETRO_DrawFilledRectangle(x, y, x + CELL_X_SIZE / 4, y + CELL_Y_SIZE / 4, 0, layer, MAP_WIDTH, MAP_HEIGHT);
 
-			// test if there is a solid block there
-			if (block == 0) {
-				RETRO_DrawRectangle(column * CELL_X_SIZE / 4,
-									row * CELL_Y_SIZE / 4,
-									column * CELL_X_SIZE / 4 + CELL_X_SIZE / 4 - 1,
-									row * CELL_Y_SIZE / 4 + CELL_Y_SIZE / 4 - 1,
-									15);
-			} else {
-				RETRO_DrawFilledRectangle(column * CELL_X_SIZE / 4,
-										row * CELL_Y_SIZE / 4,
-										column * CELL_X_SIZE / 4 + CELL_X_SIZE / 4,
-										row * CELL_Y_SIZE / 4 + CELL_Y_SIZE / 4,
-										2);
-			}
+	// test if there is a solid block there
+	if (world[row][column] == 0) {
+		RETRO_DrawRectangle(x, y, x + CELL_X_SIZE / 4 - 1, y + CELL_Y_SIZE / 4 - 1, 15, layer, MAP_WIDTH, MAP_HEIGHT);
+	} else {
+		RETRO_DrawFilledRectangle(x, y, x + CELL_X_SIZE / 4, y + CELL_Y_SIZE / 4, 2, layer, MAP_WIDTH, MAP_HEIGHT);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void Build_2D_Map(void)
+{
+	// draw every cell of the world into the map layer, after that only the
+	// cells that change need drawing again
+
+	for (int row = 0; row < WORLD_ROWS; row++) {
+		for (int column = 0; column < WORLD_COLUMNS; column++) {
+			Draw_Map_Cell(row, column);
 		}
 	}
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
+void Draw_2D_Map(void)
+{
+	// copy the map layer to the top left of the screen
+
+	for (int y = 0; y < MAP_HEIGHT; y++) {
+		memcpy(RETRO.framebuffer + RETRO.yoffset[y], map_layer[y], MAP_WIDTH);
+	}
+	RETRO_Damage(0, 0, MAP_WIDTH, MAP_HEIGHT);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 void Ray_Caster(long x, long y, long view_angle)
 {
 	// This function casts out 320 rays from the viewer and builds up the video
@@ -502,6 +527,10 @@ void Ray_Caster(long x, long y, long view_angle)
 
 			scale = cos_table[ray] * 15000 / (1e-10 + dist_x);
 
+			// remember how far away the wall is so objects can be hidden behind it
+
+			depth_buffer[ray] = dist_x / cos_table[ray];
+
 			// compute top and bottom and do a very crude clip
 
 			if ((top = 100 - scale / 2) < 1)
@@ -527,6 +556,10 @@ void Ray_Caster(long x, long y, long view_angle)
 
 			scale = cos_table[ray] * 15000 / (1e-10 + dist_y);
 
+			// remember how far away the wall is so objects can be hidden behind it
+
+			depth_buffer[ray] = dist_y / cos_table[ray];
+
 			// compute top and bottom and do a very crude clip
 
 			if ((top = 100 - scale / 2) < 1) {
@@ -646,6 +679,7 @@ void DEMO_Initialize(void)
 {
 	Build_Tables();
 	Load_World("assets/raymap.dat");
+	Build_2D_Map();
 
 	RETRO_SetPalette(RETRO_Default8bitPalette);
 }
\ No newline at end of file
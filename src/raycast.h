@@ -0,0 +1,328 @@
+// RAYCAST.H - fixed point grid traversal and billboards for the ray casting demos
+
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include "graphics.h"
+
+// D E F I N E S  ////////////////////////////////////////////////////////////
+
+#define RAYCAST_ANGLES     1920     // the circle is broken up into 1920 sub-arcs
+#define RAYCAST_CELL_FP    6        // log base 2 of the cell size
+#define RAYCAST_CELL_SIZE  (1 << RAYCAST_CELL_FP)
+
+#define RAYCAST_FP         16       // all distances and slopes are 16.16 fixed point
+#define RAYCAST_ONE        (1 << RAYCAST_FP)
+#define RAYCAST_MAX_DELTA  (1 << 29) // clamp for near axis aligned rays, far beyond any world
+
+#define RAYCAST_SIDE_X     0        // ray stopped at a vertical wall (constant x)
+#define RAYCAST_SIDE_Y     1        // ray stopped at a horizontal wall (constant y)
+
+#define RAYCAST_MAX_SPRITES 256     // most billboards drawn in one call
+#define RAYCAST_NEAR       8        // billboards closer than this are not drawn
+
+// S T R U C T U R E S ///////////////////////////////////////////////////////
+
+typedef struct ray_hit_typ
+{
+	int cell_x, cell_y;  // cell that stopped the ray
+	int hit_type;        // contents of that cell, 0 if the ray left the world
+	int side;            // RAYCAST_SIDE_X or RAYCAST_SIDE_Y
+	int column;          // texture column 0-63 at the intersection
+	int hit_x, hit_y;    // intersection point in world units
+	int distance;        // distance along the ray, 16.16
+	int perp;            // distance along the view direction, 16.16
+} ray_hit, *ray_hit_ptr;
+
+typedef struct raycast_view_typ
+{
+	int x, y;            // eye position in world units
+	int view_angle;      // direction the eye is facing
+	int left;            // screen x of the first column of the view
+	int columns;         // number of columns, one per ray
+	int center;          // column that is cast along the view angle
+	int direction;       // 1 if the ray angle grows with x, -1 if it shrinks
+	int top, bottom;     // first and last + 1 rows of the view window
+	int middle;          // the horizon row
+	int vertical_scale;  // wall height in rows times the perpendicular distance
+	const int *depth;    // perpendicular distance of the wall in each column, 16.16
+} raycast_view, *raycast_view_ptr;
+
+typedef struct raycast_billboard_typ
+{
+	sprite_ptr sprite;   // the sprite being drawn
+	int perp;            // distance along the view direction, 16.16
+	int index;           // position in the callers list, keeps the sort stable
+} raycast_billboard, *raycast_billboard_ptr;
+
+// G L O B A L S /////////////////////////////////////////////////////////////
+
+const unsigned char *raycast_world;  // row major matrix of cells
+int raycast_pitch;                   // bytes between two rows of the matrix
+int raycast_columns;
+int raycast_rows;
+
+int raycast_cos[RAYCAST_ANGLES + 1];     // direction of each angle, 16.16
+int raycast_sin[RAYCAST_ANGLES + 1];
+int raycast_tan[RAYCAST_ANGLES + 1];     // slopes used to find the exact intersection
+int raycast_cot[RAYCAST_ANGLES + 1];
+int raycast_delta_x[RAYCAST_ANGLES + 1]; // ray length between two vertical lines
+int raycast_delta_y[RAYCAST_ANGLES + 1]; // ray length between two horizontal lines
+
+// F U N C T I O N S /////////////////////////////////////////////////////////
+
+int Raycast_Fixed(double value)
+{
+	// convert to 16.16 and clamp so that sums of two values never overflow
+
+	double fp = value * RAYCAST_ONE;
+
+	if (fp > RAYCAST_MAX_DELTA) return RAYCAST_MAX_DELTA;
+	if (fp < -RAYCAST_MAX_DELTA) return -RAYCAST_MAX_DELTA;
+
+	return (int)lround(fp);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void Raycast_Init(const unsigned char *world, int pitch, int columns, int rows)
+{
+	// this function attaches the world matrix and builds the fixed point tables.
+	// all run time math is integer, so every cast is bit exact from run to run
+
+	raycast_world = world;
+	raycast_pitch = pitch;
+	raycast_columns = columns;
+	raycast_rows = rows;
+
+	for (int ang = 0; ang <= RAYCAST_ANGLES; ang++) {
+		// the small offset keeps rays off the exact axes, like the float tables
+		double rad_angle = 3.272e-4 + ang * 2 * M_PI / RAYCAST_ANGLES;
+		double c = cos(rad_angle), s = sin(rad_angle);
+
+		raycast_cos[ang] = Raycast_Fixed(c);
+		raycast_sin[ang] = Raycast_Fixed(s);
+		raycast_tan[ang] = Raycast_Fixed(s / c);
+		raycast_cot[ang] = Raycast_Fixed(c / s);
+		raycast_delta_x[ang] = Raycast_Fixed(fabs(RAYCAST_CELL_SIZE / c));
+		raycast_delta_y[ang] = Raycast_Fixed(fabs(RAYCAST_CELL_SIZE / s));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void Raycast_Cast(int x, int y, int view_angle, int ray_angle, ray_hit_ptr hit)
+{
+	// this function walks a single ray from (x,y) through the grid, one cell
+	// boundary at a time, and fills in the first solid cell it reaches.  the
+	// perpendicular distance is measured along view_angle, which cancels the
+	// fishbowl effect without a separate correction table
+
+	int cell_x = x >> RAYCAST_CELL_FP;
+	int cell_y = y >> RAYCAST_CELL_FP;
+	int delta_x = raycast_delta_x[ray_angle];
+	int delta_y = raycast_delta_y[ray_angle];
+	int step_x, step_y, x_bound, y_bound;
+	long long side_x, side_y;
+
+	// distance to the first vertical and horizontal line the ray crosses
+
+	if (raycast_cos[ray_angle] > 0) {
+		step_x = 1;
+		x_bound = (cell_x + 1) << RAYCAST_CELL_FP;
+		side_x = (long long)(x_bound - x) * delta_x >> RAYCAST_CELL_FP;
+	} else {
+		step_x = -1;
+		x_bound = cell_x << RAYCAST_CELL_FP;
+		side_x = (long long)(x - x_bound) * delta_x >> RAYCAST_CELL_FP;
+	}
+
+	if (raycast_sin[ray_angle] > 0) {
+		step_y = 1;
+		y_bound = (cell_y + 1) << RAYCAST_CELL_FP;
+		side_y = (long long)(y_bound - y) * delta_y >> RAYCAST_CELL_FP;
+	} else {
+		step_y = -1;
+		y_bound = cell_y << RAYCAST_CELL_FP;
+		side_y = (long long)(y - y_bound) * delta_y >> RAYCAST_CELL_FP;
+	}
+
+	// step into whichever neighbour is closer until a cell is not empty
+
+	int side, hit_type;
+	long long distance;
+
+	for (;;) {
+		if (side_x < side_y) {
+			cell_x += step_x;
+			distance = side_x;
+			side = RAYCAST_SIDE_X;
+		} else {
+			cell_y += step_y;
+			distance = side_y;
+			side = RAYCAST_SIDE_Y;
+		}
+
+		if (cell_x < 0 || cell_x >= raycast_columns || cell_y < 0 || cell_y >= raycast_rows) {
+			hit_type = 0;
+			break;
+		}
+
+		if ((hit_type = raycast_world[cell_y * raycast_pitch + cell_x]) != 0) {
+			break;
+		}
+
+		if (side == RAYCAST_SIDE_X) {
+			side_x += delta_x;
+			x_bound += step_x << RAYCAST_CELL_FP;
+		} else {
+			side_y += delta_y;
+			y_bound += step_y << RAYCAST_CELL_FP;
+		}
+	}
+
+	// compute the exact intersection from the grid line that was hit
+
+	long long hit_x, hit_y;
+
+	if (side == RAYCAST_SIDE_X) {
+		hit_x = (long long)x_bound << RAYCAST_FP;
+		hit_y = ((long long)y << RAYCAST_FP) + (long long)(x_bound - x) * raycast_tan[ray_angle];
+	} else {
+		hit_x = ((long long)x << RAYCAST_FP) + (long long)(y_bound - y) * raycast_cot[ray_angle];
+		hit_y = (long long)y_bound << RAYCAST_FP;
+	}
+
+	// project onto the view direction to get the perpendicular distance
+
+	long long perp = ((hit_x - ((long long)x << RAYCAST_FP)) * raycast_cos[view_angle] +
+					  (hit_y - ((long long)y << RAYCAST_FP)) * raycast_sin[view_angle]) >> RAYCAST_FP;
+
+	hit->cell_x = cell_x;
+	hit->cell_y = cell_y;
+	hit->hit_type = hit_type;
+	hit->side = side;
+	hit->hit_x = (int)(hit_x >> RAYCAST_FP);
+	hit->hit_y = (int)(hit_y >> RAYCAST_FP);
+	hit->column = (side == RAYCAST_SIDE_X ? hit->hit_y : hit->hit_x) & (RAYCAST_CELL_SIZE - 1);
+	hit->distance = (int)(distance < RAYCAST_MAX_DELTA ? distance : RAYCAST_MAX_DELTA);
+	hit->perp = (int)(perp < 1 ? 1 : perp < RAYCAST_MAX_DELTA ? perp : RAYCAST_MAX_DELTA);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int Raycast_Compare_Billboards(const void *a, const void *b)
+{
+	// far billboards first, ties in list order so the result never depends on qsort
+
+	raycast_billboard_ptr first = (raycast_billboard_ptr)a;
+	raycast_billboard_ptr second = (raycast_billboard_ptr)b;
+
+	if (first->perp != second->perp) {
+		return first->perp > second->perp ? -1 : 1;
+	}
+
+	return first->index - second->index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void Raycast_Draw_Sprites(raycast_view_ptr view, sprite_ptr *sprites, int count)
+{
+	// this function draws sprites standing in the world as billboards facing the
+	// viewer.  the x,y of each sprite is the world position of its center and
+	// the frames must be transposed with Sprite_Transpose.  billboards are drawn
+	// far to near, and each screen column is tested against the wall depth of
+	// the last cast before any texel is touched, so a column behind a wall
+	// costs a single compare
+
+	raycast_billboard billboards[RAYCAST_MAX_SPRITES];
+	int visible = 0;
+
+	// project every live sprite onto the view direction and drop those behind the eye
+
+	for (int index = 0; index < count && visible < RAYCAST_MAX_SPRITES; index++) {
+		sprite_ptr sprite = sprites[index];
+		if (sprite->state != SPRITE_ALIVE) {
+			continue;
+		}
+
+		long long perp = (long long)(sprite->x - view->x) * raycast_cos[view->view_angle] +
+						 (long long)(sprite->y - view->y) * raycast_sin[view->view_angle];
+
+		if (perp < RAYCAST_NEAR * RAYCAST_ONE || perp >= RAYCAST_MAX_DELTA) {
+			continue;
+		}
+
+		billboards[visible].sprite = sprite;
+		billboards[visible].perp = (int)perp;
+		billboards[visible].index = index;
+		visible++;
+	}
+
+	qsort(billboards, visible, sizeof(raycast_billboard), Raycast_Compare_Billboards);
+
+	for (int index = 0; index < visible; index++) {
+		sprite_ptr sprite = billboards[index].sprite;
+		int perp = billboards[index].perp;
+		int dx = sprite->x - view->x;
+		int dy = sprite->y - view->y;
+
+		// the angle to the sprite relative to the view angle gives the center
+		// column, the same angular spacing the rays were cast with
+
+		long long lateral = (long long)dy * raycast_cos[view->view_angle] - (long long)dx * raycast_sin[view->view_angle];
+		int angle = (int)lround(atan2((double)lateral, (double)perp) * RAYCAST_ANGLES / (2 * M_PI));
+		int column = view->center + view->direction * angle;
+
+		// a billboard is one cell wide and one cell high, like a wall seen head on
+
+		int height = (int)(((long long)view->vertical_scale << RAYCAST_FP) / perp);
+		int width = (int)(RAYCAST_CELL_SIZE * RAYCAST_ANGLES / (2 * M_PI) * RAYCAST_ONE / perp);
+		if (width <= 0 || height <= 0) {
+			continue;
+		}
+
+		int x1 = column - width / 2, x2 = x1 + width;
+		int y1 = view->middle - height / 2, y2 = y1 + height;
+
+		// clip against the view window once
+
+		int left = SDL_max(x1, 0), right = SDL_min(x2, view->columns);
+		int top = SDL_max(y1, view->top), bottom = SDL_min(y2, view->bottom);
+		if (left >= right || top >= bottom) {
+			continue;
+		}
+
+		int u_step = (RAYCAST_CELL_SIZE << RAYCAST_FP) / width;
+		int v_step = (RAYCAST_CELL_SIZE << RAYCAST_FP) / height;
+		int v_start = (v_step >> 1) + (top - y1) * v_step;
+		int u = (u_step >> 1) + (left - x1) * u_step;
+
+		unsigned char *frame = sprite->frames[sprite->curr_frame];
+
+		RETRO_Damage(view->left + left, top, view->left + right, bottom);
+
+		for (int x = left; x < right; x++, u += u_step) {
+			// reject the whole column if a wall is in front of the sprite
+			if (view->depth[x] <= perp) {
+				continue;
+			}
+
+			unsigned char *texel = frame + (u >> RAYCAST_FP) * SPRITE_HEIGHT;
+			unsigned char *dest = &RETRO.framebuffer[top * SCREEN_WIDTH + view->left + x];
+			int v = v_start;
+
+			for (int y = top; y < bottom; y++, v += v_step) {
+				// test for transparent pixel i.e. 0, if not transparent then draw
+				unsigned char data = texel[v >> RAYCAST_FP];
+				if (data) {
+					*dest = data;
+				}
+				dest += SCREEN_WIDTH;
+			}
+		}
+	}
+}
+
+#endif
@@ -5,7 +5,9 @@
 #include "lib/retromain.h"
 #include "lib/retrogfx.h"
 #include "lib/retrofont.h"
+#include "lib/retrothread.h"
 #include "graphics.h"
+#include "raycast.h"
 
 // T Y P E S ////////////////////////////////////////////////////////////////
 
@@ -22,6 +24,13 @@ typedef struct worm_typ
 	int counter; // counts time until movement
 } worm, *worm_ptr;
 
+// this structure holds the eye position the rays are cast from
+typedef struct view_typ
+{
+	long x, y;       // position of the viewer
+	long view_angle; // direction the viewer is facing
+} view, *view_ptr;
+
 // D E F I N E S /////////////////////////////////////////////////////////////
 
 // #define MAKING_DEMO 1     // this flag is used to turn on the demo record option.  this is for developers only
@@ -99,12 +108,19 @@ typedef struct worm_typ
 #define WORLD_X_SIZE  (WORLD_COLUMNS * CELL_X_SIZE)
 #define WORLD_Y_SIZE  (WORLD_ROWS    * CELL_Y_SIZE)
 
+// size of the 2-D map, each cell is 1/16 of its world size
+
+#define MAP_WIDTH     (WORLD_X_SIZE / 16)
+#define MAP_HEIGHT    (WORLD_Y_SIZE / 16)
+
 // G L O B A L S /////////////////////////////////////////////////////////////
 
 // world map of nxn cells, each cell is 64x64 pixels
 
 unsigned char world[WORLD_ROWS][WORLD_COLUMNS + 1];       // pointer to matrix of cells that make up world
 
+unsigned char map_layer[MAP_HEIGHT][MAP_WIDTH];          // the 2-D map, redrawn only where the world changes
+
 float tan_table[ANGLE_360 + 1];              // tangent tables used to compute initial
 float inv_tan_table[ANGLE_360 + 1];          // intersections with ray
 
@@ -116,7 +132,8 @@ float cos_table[ANGLE_360 + 1];              // used to cacell out fishbowl effe
 float inv_cos_table[ANGLE_360 + 1];          // used to compute distances by calculating
 float inv_sin_table[ANGLE_360 + 1];          // the hypontenuse
 
-int *scale_table[MAX_SCALE + 1];     // table with pre-computed scale indices
+unsigned char *scale_arena;          // pre-computed scale indices of every size, one after the other
+int scale_table[MAX_SCALE + 1];      // offset of each size into the scale arena
 
 worm worms[SCREEN_WIDTH];                   // used to make the screen melt
 
@@ -126,23 +143,23 @@ pcx_picture walls_pcx,             // holds the wall textures
 controls_pcx,             // holds the control panel at bottom of screen
 intro_pcx;                // holds the intro screen
 
+RETRO_Layer controls_layer;        // the control panel scaled to the screen, see RETRO_DrawLayer
+int controls_drawn = 0;            // the panel is in the framebuffer and stays there, see DEMO_Render
+
 int demo_mode = 0;                   // toogles demo mode on and off.  Note: this must be 0 to record a demo
 
-// parmeter block used by assembly language sliver engine
+// results of the last cast, one entry per ray
 
-unsigned char *sliver_texture; // pointer to texture being rendered
-int sliver_column;        // index into texture i.e. which column of texture
-int sliver_top;           // starting Y position to render at
-int sliver_scale;         // overall height of sliver
-int sliver_ray;           // current ray being cast
-int sliver_clip;          // index into texture after clipping
-int *scale_row;           // row of scale value look up table to use
+ray_hit ray_hits[320];
+int ray_depth[320];       // perpendicular wall distance of each view column, 16.16
 
 // the player
 int player_x,                 // the players X position
 player_y,                 // the players Y position
 player_view_angle;        // the current view angle of the player
 
+view player_last;         // the view before the last update, frames are drawn in between
+
 unsigned char *demo;      // table of data for demo mode
 
 // if the code gets enabled it allocates various data to create a demo file
@@ -178,55 +195,59 @@ void Render_Sliver1(sprite_ptr sprite, long scale, int column)
 	fixed scale_index = 0;
 	fixed scale_step = (fixed)(((fixed)64) << 16) / scale;
 
-	// alias a pointer to sprite for ease of access
-	unsigned char *work_sprite = sprite->frames[sprite->curr_frame];
+	// alias a pointer to the texture column, frames are stored transposed
+	unsigned char *work_sprite = sprite->frames[sprite->curr_frame] + column * SPRITE_HEIGHT;
 
 	// compute offset of sprite in video buffer
 	int offset = (sprite->y * SCREEN_WIDTH) + sprite->x;
 
+	RETRO_Damage(sprite->x, sprite->y, sprite->x + 1, sprite->y + scale_int);
+
 	for (int y = 0; y < scale_int; y++) {
-		RETRO.framebuffer[offset] = work_sprite[work_offset + column];
+		RETRO.framebuffer[offset] = work_sprite[work_offset];
 		scale_index += scale_step;
 		offset += SCREEN_WIDTH;
-		work_offset = ((scale_index & 0xff00) >> 2);
+		work_offset = ((scale_index & 0xff00) >> 8);
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-void Render_Sliver2(sprite_ptr sprite, int scale, int column)
+void Render_Sliver2(unsigned char *texture, int x, int y, int scale, int column)
 {
 	// this is yet another version of the sliver scaler, however it uses look up
 	// tables with pre-computed scale indices.  in the end I converted this to
-	// assembly for speed
+	// assembly for speed.  it only touches its own video column, so the
+	// caller is responsible for marking the view as damaged
 
 	int work_offset = 0, scale_off = 0;
 
 	// alias proper data row
-	int *row = scale_table[scale];
+	unsigned char *row = scale_arena + scale_table[scale];
 
 	if (scale > (WINDOW_HEIGHT - 1)) {
 		scale_off = (scale - (WINDOW_HEIGHT - 1)) >> 1;
 		scale = (WINDOW_HEIGHT - 1);
-		sprite->y = 0;
+		y = 0;
 	}
 
-	// alias a pointer to sprite for ease of access
-	unsigned char *work_sprite = sprite->frames[sprite->curr_frame];
+	// alias the texture column, textures are stored transposed so the
+	// column is a contiguous run of texels
+	unsigned char *texel = texture + column * SPRITE_HEIGHT;
 
-	// compute offset of sprite in video buffer
-	int offset = (sprite->y * SCREEN_WIDTH) + sprite->x;
+	// compute offset of sliver in video buffer
+	int offset = (y * SCREEN_WIDTH) + x;
 
-	for (int y = 0; y < scale; y++) {
-		RETRO.framebuffer[offset] = work_sprite[work_offset + column];
+	for (int i = 0; i < scale; i++) {
+		RETRO.framebuffer[offset] = texel[work_offset];
 		offset += SCREEN_WIDTH;
-		work_offset = row[y + scale_off];
+		work_offset = row[i + scale_off];
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
-void Create_Scale_Data(int scale, int *row)
+void Create_Scale_Data(int scale, unsigned char *row)
 {
 	// this function synthesizes the scaling of a texture sliver to all possible
 	// sizes and creates a huge look up table of the data.
@@ -239,11 +260,14 @@ void Create_Scale_Data(int scale, int *row)
 	y_scale_index += y_scale_step;
 
 	for (int y = 0; y < scale; y++) {
-		// place data into proper array position for later use
-		row[y] = ((int)(y_scale_index + .5)) * CELL_X_SIZE;
+		// note: these are texel rows, the textures are stored transposed
+		int index = (int)(y_scale_index + .5);
 
 		// test if we slightly went overboard
-		if (row[y] > 63 * CELL_X_SIZE) row[y] = 63 * CELL_X_SIZE;
+		if (index > 63) index = 63;
+
+		// place data into proper array position for later use
+		row[y] = index;
 
 		// next index please
 		y_scale_index += y_scale_step;
@@ -257,11 +281,14 @@ void Build_Tables(void)
 	// this function builds all the look up tables for the system
 
 	// create the lookup tables for the scaler
-	// there have the form of an array of pointers, where each pointer points
-	// another another array of data where the 'data' are the scale indices
+	// all the rows of scale indices are packed into one arena, a row for size n
+	// has n byte sized entries and the table holds the offset of each row
+	int size = 0;
 	for (int scale = 0; scale <= MAX_SCALE; scale++) {
-		scale_table[scale] = (int *)malloc(scale * sizeof(int) + 1);
+		scale_table[scale] = size;
+		size += scale;
 	}
+	scale_arena = (unsigned char *)malloc(size);
 
 	// create tables, sit back for a sec!
 	for (int ang = ANGLE_0; ang <= ANGLE_360; ang++) {
@@ -300,11 +327,14 @@ void Build_Tables(void)
 		cos_table[ang + ANGLE_30] = (float)(VERTICAL_SCALE / cos(rad_angle));
 	}
 
+	// build the fixed point tables used by the ray caster
+	Raycast_Init(&world[0][0], WORLD_COLUMNS + 1, WORLD_COLUMNS, WORLD_ROWS);
+
 	// build the scaler table.  This table holds MAX_SCALE different arrays.  Each
 	// array consists of the pre-computed indices for an object to be scaled
 	for (int scale = 1; scale <= MAX_SCALE; scale++) {
 		// create the indices for this scale
-		Create_Scale_Data(scale, (int *)scale_table[scale]);
+		Create_Scale_Data(scale, scale_arena + scale_table[scale]);
 	}
 }
 
@@ -349,7 +379,18 @@ int Load_World(const char *file)
 
 void sline(long x1, long y1, long x2, long y2, int color)
 {
-	// used a a diagnostic function to draw a scaled line
+	// used a a diagnostic function to draw a scaled line, a ray that left the
+	// world through an open door is cut at the edge so it stays on the map
+
+	double t = 1;
+	if (x2 < 0) t = SDL_min(t, (double)x1 / (x1 - x2));
+	if (x2 >= WORLD_X_SIZE) t = SDL_min(t, (double)(WORLD_X_SIZE - 1 - x1) / (x2 - x1));
+	if (y2 < 0) t = SDL_min(t, (double)y1 / (y1 - y2));
+	if (y2 >= WORLD_Y_SIZE) t = SDL_min(t, (double)(WORLD_Y_SIZE - 1 - y1) / (y2 - y1));
+	if (t < 1) {
+		x2 = x1 + (long)((x2 - x1) * t);
+		y2 = y1 + (long)((y2 - y1) * t);
+	}
 
 	x1 = x1 / 16;
 	y1 = (y1 / 16);
@@ -392,404 +433,213 @@ void Demo_Setup(void)
 
 void Draw_Ground(void)
 {
+	RETRO_PROFILE("Draw_Ground");
+
 	RETRO_DrawFilledRectangle(RETRO_WIDTH / 2 - 1, 0, RETRO_WIDTH - 1, 80, 0);
 	RETRO_DrawFilledRectangle(RETRO_WIDTH / 2 - 1, 80, RETRO_WIDTH - 1, 160, 8);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-void Draw_2D_Map(void)
+void Draw_Map_Cell(int row, int column)
 {
-	// draw 2-D map of world
+	// draw one cell of the 2-D map into the map layer
 
-	for (int row = 0; row < WORLD_ROWS; row++) {
-		for (int column = 0; column < WORLD_COLUMNS; column++) {
-			int block = world[row][column];
-
-			// test if there is a solid block there
-			if (block == 0) {
-				RETRO_DrawRectangle(column * CELL_X_SIZE / 16,
-									row * CELL_Y_SIZE / 16,
-									column * CELL_X_SIZE / 16 + CELL_X_SIZE / 16 - 1,
-									row * CELL_Y_SIZE / 16 + CELL_Y_SIZE / 16 - 1,
-									15);
-			} else {
-				RETRO_DrawFilledRectangle(column * CELL_X_SIZE / 16,
-										row * CELL_Y_SIZE / 16,
-										column * CELL_X_SIZE / 16 + CELL_X_SIZE / 16,
-										row * CELL_Y_SIZE / 16 + CELL_Y_SIZE / 16,
-										2);
-			}
-		}
+	unsigned char *layer = &map_layer[0][0];
+	int x = column * CELL_X_SIZE / 16;
+	int y = row * CELL_Y_SIZE / 16;
+
+	RETRO_DrawFilledRectangle(x, y, x + CELL_X_SIZE / 16, y + CELL_Y_SIZE / 16, 0, layer, MAP_WIDTH, MAP_HEIGHT);
+
+	// test if there is a solid block there
+	if (world[row][column] == 0) {
+		RETRO_DrawRectangle(x, y, x + CELL_X_SIZE / 16 - 1, y + CELL_Y_SIZE / 16 - 1, 15, layer, MAP_WIDTH, MAP_HEIGHT);
+	} else {
+		RETRO_DrawFilledRectangle(x, y, x + CELL_X_SIZE / 16, y + CELL_Y_SIZE / 16, 2, layer, MAP_WIDTH, MAP_HEIGHT);
 	}
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-void Ray_Caster(long x, long y, long view_angle)
+void Build_2D_Map(void)
 {
-	// This is the heart of the system.  it casts out 320 rays and builds the
-	// 3-D image from their intersections with the walls.  It was derived from
-	// the previous version used in "RAY.C", however, it has been extremely
-	// optimized for speed by the use of many more lookup tables and fixed
-	// point math
-
-	int
-		cell_x,       // the current cell that the ray is in
-		cell_y,
-		ray,          // the current ray being cast 0-320
-		casting = 2,    // tracks the progress of the X and Y component of the ray
-		x_hit_type,   // records the block that was intersected, used to figure
-		y_hit_type,   // out which texture to use
-		x_bound,      // the next vertical and horizontal intersection point
-		y_bound,
-		next_y_cell,  // used to figure out the quadrant of the ray
-		next_x_cell,
-		xray = 0,       // tracks the progress of a ray looking for Y interesctions
-		yray = 0,       // tracks the progress of a ray looking for X interesctions
-
-		x_delta,      // the amount needed to move to get to the next cell
-		y_delta,      // position
-		xi_save,      // used to save exact x and y intersection points
-		yi_save,
-		scale;
-
-	long
-		dist_x,  // the distance of the x and y ray intersections from
-		dist_y;  // the viewpoint
-
-	float xi,     // used to track the x and y intersections
-		yi;
-
-	// S E C T I O N  1 /////////////////////////////////////////////////////////v
-
-	// initialization
-
-	// compute starting angle from player.  Field of view is 60 degrees, so
-	// subtract half of that current view angle
-
-	if ((view_angle -= ANGLE_30) < 0) {
-		view_angle = ANGLE_360 + view_angle;
-	}
-
-	// loop through all 320 rays
-
-	for (ray = 319; ray >= 0; ray--) {
-
-		// S E C T I O N  2 /////////////////////////////////////////////////////////
-
-		// compute first x intersection
-
-		// need to know which half plane we are casting from relative to Y axis
-
-		if (view_angle >= ANGLE_0 && view_angle < ANGLE_180) {
-
-			// compute first horizontal line that could be intersected with ray
-			// note: it will be above player
-
-			y_bound = (CELL_Y_SIZE + (y & 0xffc0));
-
-			// compute delta to get to next horizontal line
-
-			y_delta = CELL_Y_SIZE;
-
-			// based on first possible horizontal intersection line, compute X
-			// intercept, so that casting can begin
-
-			xi = inv_tan_table[view_angle] * (y_bound - y) + x;
-
-			// set cell delta
-
-			next_y_cell = 0;
-
-		} // end if upper half plane
-		else {
-			// compute first horizontal line that could be intersected with ray
-			// note: it will be below player
-
-			y_bound = (int)(y & 0xffc0);
-
-			// compute delta to get to next horizontal line
-
-			y_delta = -CELL_Y_SIZE;
-
-			// based on first possible horizontal intersection line, compute X
-			// intercept, so that casting can begin
-
-			xi = inv_tan_table[view_angle] * (y_bound - y) + x;
-
-			// set cell delta
-
-			next_y_cell = -1;
-
-		} // end else lower half plane
-
-		// S E C T I O N  3 /////////////////////////////////////////////////////////
-
-		// compute first y intersection
-
-		// need to know which half plane we are casting from relative to X axis
-
-		if (view_angle < ANGLE_90 || view_angle >= ANGLE_270) {
-
-			// compute first vertical line that could be intersected with ray
-			// note: it will be to the right of player
-
-			x_bound = (int)(CELL_X_SIZE + (x & 0xffc0));
-
-			// compute delta to get to next vertical line
-
-			x_delta = CELL_X_SIZE;
-
-			// based on first possible vertical intersection line, compute Y
-			// intercept, so that casting can begin
-
-			yi = tan_table[view_angle] * (x_bound - x) + y;
-
-			// set cell delta
-
-			next_x_cell = 0;
-
-		} // end if right half plane
-		else {
-
-			// compute first vertical line that could be intersected with ray
-			// note: it will be to the left of player
-
-			x_bound = (int)(x & 0xffc0);
-
-			// compute delta to get to next vertical line
-
-			x_delta = -CELL_X_SIZE;
+	// draw every cell of the world into the map layer, after that only the
+	// cells that change need drawing again
 
-			// based on first possible vertical intersection line, compute Y
-			// intercept, so that casting can begin
-
-			yi = tan_table[view_angle] * (x_bound - x) + y;
-
-			// set cell delta
-
-			next_x_cell = -1;
-
-		} // end else right half plane
-
-		// begin cast
-
-		casting = 2;                // two rays to cast simultaneously
-		xray = yray = 0;                // reset intersection flags
-
-		// S E C T I O N  4 /////////////////////////////////////////////////////////
-
-		while (casting) {
-
-			// continue casting each ray in parallel
-
-			if (xray != INTERSECTION_FOUND) {
-
-				// compute current map position to inspect
-
-				cell_x = ((x_bound + next_x_cell) >> CELL_X_SIZE_FP);
-
-				cell_y = (int)yi;
-				cell_y >>= CELL_Y_SIZE_FP;
-
-				// Make sure values are within bounds
-
-				bool oob = false;
-				if (cell_x < 0 || cell_x > WORLD_COLUMNS || cell_y < 0 || cell_y > WORLD_ROWS) {
-					oob = true;
-				}
-
-				// test if there is a block where the current x ray is intersecting
-
-				if (oob || (x_hit_type = world[cell_y][cell_x]) != 0) {
-					// compute distance
-
-					dist_x = (long)((yi - y) * inv_sin_table[view_angle]);
-					yi_save = (int)yi;
-
-					// terminate X casting
-
-					xray = INTERSECTION_FOUND;
-					casting--;
-
-				} // end if a hit
-				else {
-
-					// compute next Y intercept
-
-					yi += y_step[view_angle];
-
-					// find next possible x intercept point
-
-					x_bound += x_delta;
-
-				} // end else
-
-			} // end if x ray has intersected
-
-			// S E C T I O N  5 /////////////////////////////////////////////////////////
-
-			if (yray != INTERSECTION_FOUND) {
-
-				// compute current map position to inspect
-
-				cell_x = xi;
-				cell_x >>= CELL_X_SIZE_FP;
-
-				cell_y = ((y_bound + next_y_cell) >> CELL_Y_SIZE_FP);
-
-				// Make sure values are within bounds
-
-				bool oob = false;
-				if (cell_x < 0 || cell_x > WORLD_COLUMNS || cell_y < 0 || cell_y > WORLD_ROWS) {
-					oob = true;
-				}
-
-				// test if there is a block where the current y ray is intersecting
-
-				if (oob || (y_hit_type = world[cell_y][cell_x]) != 0) {
-
-					// compute distance
-
-					dist_y = (long)((xi - x) * inv_cos_table[view_angle]);
-					xi_save = (int)xi;
-
-					yray = INTERSECTION_FOUND;
-					casting--;
-
-				} // end if a hit
-				else {
-
-					// terminate Y casting
-
-					xi += x_step[view_angle];
-
-					// compute next possible y intercept
+	for (int row = 0; row < WORLD_ROWS; row++) {
+		for (int column = 0; column < WORLD_COLUMNS; column++) {
+			Draw_Map_Cell(row, column);
+		}
+	}
+}
 
-					y_bound += y_delta;
+/////////////////////////////////////////////////////////////////////////////
 
-				} // end else
+void Draw_2D_Map(void)
+{
+	// copy the map layer to the top left of the screen
 
-			} // end if y ray has intersected
+	RETRO_PROFILE("Draw_2D_Map");
 
-		} // end while not done
+	for (int y = 0; y < MAP_HEIGHT; y++) {
+		memcpy(RETRO.framebuffer + RETRO.yoffset[y], map_layer[y], MAP_WIDTH);
+	}
+	RETRO_Damage(0, 0, MAP_WIDTH, MAP_HEIGHT);
+}
 
-		// S E C T I O N  6 /////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////
 
-		// at this point, we know that the ray has succesfully hit both a
-		// vertical wall and a horizontal wall, so we need to see which one
-		// was closer and then render it
+void Ray_Column(int ray, void *data)
+{
+	// casts and renders a single ray.  this runs on the worker threads, so it
+	// must only write its own video column and its own entry of ray_hits
 
-		if (dist_x < dist_y) {
+	view_ptr eye = (view_ptr)data;
+	ray_hit_ptr hit = &ray_hits[ray];
 
-			sline(x, y, (long)x_bound, (long)yi_save, 1);
+	int texture,      // the wall texture to use
+		scale,
+		sliver_scale; // overall height of sliver
 
-			// there was a vertical wall closer than the horizontal
+	// rays are cast from right to left, starting half the field of view
+	// (30 degrees) before the view angle
 
-			// compute actual scale and multiply by view filter so that spherical
-			// distortion is cancelled
+	int ray_angle = (eye->view_angle - ANGLE_30 + (319 - ray) + ANGLE_360) % ANGLE_360;
 
-			scale = (int)(cos_table[ray] / dist_x);
+	// walk the ray through the grid until it hits a wall, the fixed point
+	// traversal returns the perpendicular distance so there is no fishbowl
 
-			// clip wall sliver against view port
+	Raycast_Cast(eye->x, eye->y, eye->view_angle, ray_angle, hit);
 
-			if (scale > (MAX_SCALE - 1)) scale = (MAX_SCALE - 1);
+	// remember how far the wall is for the sprites, the view runs left to right
+	ray_depth[319 - ray] = hit->perp;
 
-			scale_row = scale_table[scale - 1];
+	// vertical walls use the even textures, horizontal walls the odd ones
 
-			if (scale > (WINDOW_HEIGHT - 1)) {
-				sliver_clip = (scale - (WINDOW_HEIGHT - 1)) >> 1;
-				scale = (WINDOW_HEIGHT - 1);
-			} else
-				sliver_clip = 0;
+	texture = (hit->side == RAYCAST_SIDE_X) ? hit->hit_type : hit->hit_type + 1;
 
-			sliver_scale = scale - 1;
+	// compute actual scale from the perpendicular distance
 
-			// set up parameters for assembly language
-			// sliver_texture  ; a pointer to the texture memory
-			// sliver_column   ; the current texture column
-			// sliver_top      ; the starting Y of the sliver
-			// sliver_scale    ; the over all height of the sliver
-			// sliver_ray      ; the current video column
-			// sliver_clip     ; how much of the texture is being clipped
-			// scale_row       ; the pointer to the proper row of pre-computed scale indices
+	scale = (int)(((long long)VERTICAL_SCALE << RAYCAST_FP) / hit->perp);
 
-			sliver_texture = object.frames[x_hit_type];
-			sliver_column = (yi_save & 63);
-			sliver_top = WINDOW_MIDDLE - (scale >> 1);
-			sliver_ray = 638 - ray;
+	// clip wall sliver against view port
 
-			// render the sliver
-			object.curr_frame = x_hit_type;
-			object.x = sliver_ray;
-			object.y = sliver_top;
-			Render_Sliver2(&object, sliver_scale, sliver_column);
+	if (scale > (MAX_SCALE - 1)) scale = (MAX_SCALE - 1);
+	if (scale < 1) scale = 1;
+	if (scale > (WINDOW_HEIGHT - 1)) scale = (WINDOW_HEIGHT - 1);
 
-		} // end if
+	sliver_scale = scale - 1;
 
-		else // must of hit a horizontal wall first
-		{
-			sline(x, y, (long)xi_save, (long)y_bound, 1);
+	// render the sliver
+	Render_Sliver2(object.frames[texture], 638 - ray, WINDOW_MIDDLE - (scale >> 1), sliver_scale, hit->column);
+}
 
-			// there was a vertical wall closer than the horizontal
+/////////////////////////////////////////////////////////////////////////////
 
-			// compute actual scale and multiply by view filter so that spherical
-			// distortion is cancelled
+void Ray_Caster(long x, long y, long view_angle)
+{
+	// This is the heart of the system.  it casts out 320 rays and builds the
+	// 3-D image from their intersections with the walls.  It was derived from
+	// the previous version used in "RAY.C", however, it has been extremely
+	// optimized for speed by the use of many more lookup tables and fixed
+	// point math.  the rays are independent, so they are cast in strips of
+	// columns on the worker pool
 
-			scale = (int)(cos_table[ray] / dist_y);
+	RETRO_PROFILE("Ray_Caster");
 
-			// do clipping again
+	view eye = { x, y, view_angle };
 
-			if (scale > (MAX_SCALE - 1)) scale = (MAX_SCALE - 1);
+	RETRO_ParallelFor(320, 16, Ray_Column, &eye);
 
-			scale_row = scale_table[scale - 1];
+	// the workers only write pixels, so mark the whole view at once
+	RETRO_Damage(319, 0, 639, WINDOW_HEIGHT);
 
-			if (scale > (WINDOW_HEIGHT - 1)) {
-				sliver_clip = (scale - (WINDOW_HEIGHT - 1)) >> 1;
-				scale = (WINDOW_HEIGHT - 1);
-			} else
-				sliver_clip = 0;
+	// draw the rays on the 2-D map, this is shared so it is done here
+	for (int ray = 319; ray >= 0; ray--) {
+		sline(x, y, (long)ray_hits[ray].hit_x, (long)ray_hits[ray].hit_y, 1);
+	}
 
-			sliver_scale = scale - 1;
+} // end Ray_Caster
 
-			// set up parameters for assembly language
-			// sliver_texture  ; a pointer to the texture memory
-			// sliver_column   ; the current texture column
-			// sliver_top      ; the starting Y of the sliver
-			// sliver_scale    ; the over all height of the sliver
-			// sliver_ray      ; the current video column
-			// sliver_clip     ; how much of the texture is being clipped
-			// scale_row       ; the pointer to the proper row of pre-computed scale indices
+/////////////////////////////////////////////////////////////////////////////
 
-			sliver_texture = object.frames[y_hit_type + 1];
-			sliver_column = (xi_save & 63);
-			sliver_top = WINDOW_MIDDLE - (scale >> 1);
-			sliver_ray = 638 - ray;
+void Ray_Cast_Float(long x, long y, long view_angle, ray_hit_ptr hit)
+{
+	// the original floating point caster, which steps an X and a Y ray in
+	// parallel.  it is only kept as a reference for the benchmarks
 
-			// render the sliver
-			object.curr_frame = y_hit_type + 1;
-			object.x = sliver_ray;
-			object.y = sliver_top;
-			Render_Sliver2(&object, sliver_scale, sliver_column);
+	int cell_x, cell_y, x_hit_type = 0, y_hit_type = 0, x_bound, y_bound;
+	int next_x_cell, next_y_cell, x_delta, y_delta, xray = 0, yray = 0, casting = 2;
+	float xi, yi, dist_x = 0, dist_y = 0;
 
-		} // end else
+	// compute first x intersection
 
-		// S E C T I O N  7 /////////////////////////////////////////////////////////
+	if (view_angle >= ANGLE_0 && view_angle < ANGLE_180) {
+		y_bound = (CELL_Y_SIZE + (y & 0xffc0));
+		y_delta = CELL_Y_SIZE;
+		next_y_cell = 0;
+	} else {
+		y_bound = (int)(y & 0xffc0);
+		y_delta = -CELL_Y_SIZE;
+		next_y_cell = -1;
+	}
+	xi = inv_tan_table[view_angle] * (y_bound - y) + x;
 
-		// cast next ray
+	// compute first y intersection
 
-		// test if view angle need to wrap around
+	if (view_angle < ANGLE_90 || view_angle >= ANGLE_270) {
+		x_bound = (int)(CELL_X_SIZE + (x & 0xffc0));
+		x_delta = CELL_X_SIZE;
+		next_x_cell = 0;
+	} else {
+		x_bound = (int)(x & 0xffc0);
+		x_delta = -CELL_X_SIZE;
+		next_x_cell = -1;
+	}
+	yi = tan_table[view_angle] * (x_bound - x) + y;
 
-		if (++view_angle >= ANGLE_360) {
+	while (casting) {
+		if (xray != INTERSECTION_FOUND) {
+			cell_x = ((x_bound + next_x_cell) >> CELL_X_SIZE_FP);
+			cell_y = (int)yi >> CELL_Y_SIZE_FP;
 
-			view_angle = 0;
+			if (cell_x < 0 || cell_x >= WORLD_COLUMNS || cell_y < 0 || cell_y >= WORLD_ROWS || (x_hit_type = world[cell_y][cell_x]) != 0) {
+				dist_x = (yi - y) * inv_sin_table[view_angle];
+				xray = INTERSECTION_FOUND;
+				casting--;
+			} else {
+				yi += y_step[view_angle];
+				x_bound += x_delta;
+			}
+		}
 
-		} // end if
+		if (yray != INTERSECTION_FOUND) {
+			cell_x = (int)xi >> CELL_X_SIZE_FP;
+			cell_y = ((y_bound + next_y_cell) >> CELL_Y_SIZE_FP);
 
-	} // end for ray
+			if (cell_x < 0 || cell_x >= WORLD_COLUMNS || cell_y < 0 || cell_y >= WORLD_ROWS || (y_hit_type = world[cell_y][cell_x]) != 0) {
+				dist_y = (xi - x) * inv_cos_table[view_angle];
+				yray = INTERSECTION_FOUND;
+				casting--;
+			} else {
+				xi += x_step[view_angle];
+				y_bound += y_delta;
+			}
+		}
+	}
 
-} // end Ray_Caster
+	if (dist_x < dist_y) {
+		hit->side = RAYCAST_SIDE_X;
+		hit->hit_type = x_hit_type;
+		hit->column = (int)yi & 63;
+		hit->distance = (int)dist_x;
+	} else {
+		hit->side = RAYCAST_SIDE_Y;
+		hit->hit_type = y_hit_type;
+		hit->column = (int)xi & 63;
+		hit->distance = (int)dist_y;
+	}
+}
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -834,6 +684,7 @@ void Destroy_Door(int x_cell, int y_cell, int command)
 
 			// say bye-bye to door
 			world[door_y_cell][door_x_cell] = 0;
+			Draw_Map_Cell(door_y_cell, door_x_cell);
 
 			// reset palette register
 			red_glow.red = 0;
@@ -843,10 +694,39 @@ void Destroy_Door(int x_cell, int y_cell, int command)
 	}
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+void Interpolate_View(view_ptr eye)
+{
+	// place the eye between the last two updates, as far as the frame lies
+	// past the last one, turning the short way around the circle
+
+	long turn = player_view_angle - player_last.view_angle;
+
+	if (turn > ANGLE_180) {
+		turn -= ANGLE_360;
+	} else if (turn < -ANGLE_180) {
+		turn += ANGLE_360;
+	}
+
+	eye->x = player_last.x + lround((player_x - player_last.x) * RETRO.alpha);
+	eye->y = player_last.y + lround((player_y - player_last.y) * RETRO.alpha);
+	eye->view_angle = player_last.view_angle + lround(turn * RETRO.alpha);
+
+	if (eye->view_angle < ANGLE_0) {
+		eye->view_angle += ANGLE_360;
+	} else if (eye->view_angle > ANGLE_360) {
+		eye->view_angle -= ANGLE_360;
+	}
+}
+
 // M A I N ///////////////////////////////////////////////////////////////////
 
-void DEMO_Render(double deltatime)
+void DEMO_Update(void)
 {
+	// move the world one fixed step of 1/60 s, the player moves STEP_LENGTH
+	// and turns ANGLE_3 per step no matter how fast the frames are drawn
+
 #if MAKING_DEMO
 	demo_word = 0;
 #endif
@@ -855,62 +735,72 @@ void DEMO_Render(double deltatime)
 	float dx = 0;
 	float dy = 0;
 
-	// draw top view of world
-	Draw_2D_Map();
+	player_last.x = player_x;
+	player_last.y = player_y;
+	player_last.view_angle = player_view_angle;
 
 	static int demo_index = 0;
-	unsigned char demo_data;
-
-	if (demo_mode) {
-		// read raw key from file
-		demo_data = demo[demo_index++];
-
-		// test for end of demo, if at end start demo over
-		if (demo_data == END_OF_DEMO) {
-			// reset data index
-			demo_index = 0;
-
-			// move player to starting position again
-			player_x = 53 * 64 + 25;
-			player_y = 14 * 64 + 25;
-			player_view_angle = ANGLE_60;
+	unsigned char demo_data = 0;
+
+	// time reading the keys and the demo as input
+	{
+		RETRO_PROFILE("input");
+
+		if (demo_mode) {
+			// read raw key from file
+			demo_data = demo[demo_index++];
+
+			// a timedemo stops at the end, otherwise start demo over
+			if (demo_data == END_OF_DEMO && RETRO.timedemo) {
+				demo_index--;
+				demo_data = 0;
+				RETRO_Quit();
+			} else if (demo_data == END_OF_DEMO) {
+				// reset data index
+				demo_index = 0;
+
+				// move player to starting position again
+				player_x = player_last.x = 53 * 64 + 25;
+				player_y = player_last.y = 14 * 64 + 25;
+				player_view_angle = player_last.view_angle = ANGLE_60;
+			}
 		}
-	}
 
-	// what is user doing
+		// what is user doing
 
-	if (RETRO_KeyState(SDL_SCANCODE_LEFT) || (demo_data & DEMO_LEFT)) {
-		if ((player_view_angle -= ANGLE_3) < ANGLE_0) {
-			player_view_angle = ANGLE_360;
-		}
+		if (RETRO_KeyState(SDL_SCANCODE_LEFT) || (demo_data & DEMO_LEFT)) {
+			if ((player_view_angle -= ANGLE_3) < ANGLE_0) {
+				player_view_angle = ANGLE_360;
+			}
 #if MAKING_DEMO
-		demo_word |= DEMO_LEFT;
+			demo_word |= DEMO_LEFT;
 #endif
-	}
-
-	if (RETRO_KeyState(SDL_SCANCODE_RIGHT) || (demo_data & DEMO_RIGHT)) {
-		if ((player_view_angle += ANGLE_3) >= ANGLE_360) {
-			player_view_angle = ANGLE_0;
 		}
+
+		if (RETRO_KeyState(SDL_SCANCODE_RIGHT) || (demo_data & DEMO_RIGHT)) {
+			if ((player_view_angle += ANGLE_3) >= ANGLE_360) {
+				player_view_angle = ANGLE_0;
+			}
 #if MAKING_DEMO
-		demo_word |= DEMO_RIGHT;
+			demo_word |= DEMO_RIGHT;
 #endif
-	}
+		}
 
-	if (RETRO_KeyState(SDL_SCANCODE_UP) || (demo_data & DEMO_UP)) {
-		dx = (float)(cos(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
-		dy = (float)(sin(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
+		if (RETRO_KeyState(SDL_SCANCODE_UP) || (demo_data & DEMO_UP)) {
+			dx = (float)(cos(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
+			dy = (float)(sin(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
 #if MAKING_DEMO
-		demo_word |= DEMO_UP;
+			demo_word |= DEMO_UP;
 #endif
-	}
+		}
 
-	if (RETRO_KeyState(SDL_SCANCODE_DOWN) || (demo_data & DEMO_DOWN)) {
-		dx = (float)(-cos(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
-		dy = (float)(-sin(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
+		if (RETRO_KeyState(SDL_SCANCODE_DOWN) || (demo_data & DEMO_DOWN)) {
+			dx = (float)(-cos(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
+			dy = (float)(-sin(6.28 * player_view_angle / ANGLE_360) * STEP_LENGTH);
 #if MAKING_DEMO
-		demo_word |= DEMO_DOWN;
+			demo_word |= DEMO_DOWN;
 #endif
+		}
 	}
 
 	// S E C T I O N   5 /////////////////////////////////////////////////////////
@@ -987,6 +877,12 @@ void DEMO_Render(double deltatime)
 
 	// call all responder and temporal functions that occur each frame
 	Destroy_Door(0, 0, PROCESS_DOOR_DESTROY);
+}
+
+void DEMO_Render(double deltatime)
+{
+	// draw top view of world
+	Draw_2D_Map();
 
 	// S E C T I O N   7 /////////////////////////////////////////////////////////
 
@@ -994,16 +890,22 @@ void DEMO_Render(double deltatime)
 	Draw_Ground();
 
 	// render the view
-	Ray_Caster(player_x, player_y, player_view_angle);
+	view eye;
+	Interpolate_View(&eye);
+	Ray_Caster(eye.x, eye.y, eye.view_angle);
 
 	// do all rendering that goes on top of 3-D view here
 	if (demo_mode) {
 		Blit_String(SCREEN_WIDTH / 2, 16, 10, "D e m o   M o d e", 0);
 	}
 
-	RECT src_rect = { 0, 0, controls_pcx.header.horz_res, controls_pcx.header.vert_res }, // the source rectangle
-	dest_rect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT }; // the destination rectangle
-	Blit_Rect(src_rect, controls_pcx.buffer, controls_pcx.header.horz_res, dest_rect, RETRO.framebuffer, SCREEN_WIDTH, 0);
+	// the control panel has no pixels over the view or the map, so with the
+	// screen no longer cleared it only has to be drawn into the first frame
+	if (!controls_drawn) {
+		RETRO_PROFILE("RETRO_DrawLayer");
+		RETRO_DrawLayer(&controls_layer, controls_pcx.buffer, controls_pcx.header.horz_res, controls_pcx.header.vert_res, controls_pcx.header.horz_res, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+		controls_drawn = 1;
+	}
 }
 
 void DEMO_Initialize(void)
@@ -1013,13 +915,17 @@ void DEMO_Initialize(void)
 	PCX_Load("assets/warintr2.pcx", (pcx_picture_ptr)&intro_pcx, 1);
 //	PCX_Show_Buffer((pcx_picture_ptr)&intro_pcx);
 
-	// load the demo information
+	// load the demo information, a timedemo always plays it back
 	Demo_Setup();
+	if (RETRO.timedemo) {
+		demo_mode = 1;
+	}
 
 	// build all the lookup tables
 	Build_Tables();
 
 	Load_World("assets/warmap.dat");
+	Build_2D_Map();
 
 	// load up the textures
 	PCX_Init((pcx_picture_ptr)&walls_pcx);
@@ -1048,6 +954,9 @@ void DEMO_Initialize(void)
 	// dont need textures anymore
 	PCX_Delete((pcx_picture_ptr)&walls_pcx);
 
+	// store the walls column by column for the sliver renderer
+	Sprite_Transpose((sprite_ptr)&object);
+
 	// load up the control panel
 	PCX_Init((pcx_picture_ptr)&controls_pcx);
 	PCX_Load("assets/warcont.pcx", (pcx_picture_ptr)&controls_pcx, 0);
@@ -1061,19 +970,336 @@ void DEMO_Initialize(void)
 	object.y = 0;
 
 	// position the player somewhere interseting
-	player_x = 53 * 64 + 25;
-	player_y = 14 * 64 + 25;
-	player_view_angle = ANGLE_60;
+	player_x = player_last.x = 53 * 64 + 25;
+	player_y = player_last.y = 14 * 64 + 25;
+	player_view_angle = player_last.view_angle = ANGLE_60;
 
 	red_glow.red = 0;
 	red_glow.green = 0;
 	red_glow.blue = 0;
 
 	Set_Palette_Register(red_glow_index, (RGB_color_ptr)&red_glow);
+
+	// every frame redraws the map and the view, the rest of the screen is left
+	// alone and only the damage of the frame is converted by RETRO_Flip
+	RETRO_SetAutoClear(false);
+}
+
+typedef struct ray_bench_typ
+{
+	int rays;     // number of rays cast over the field of view
+	int use_fixed; // use the fixed point traversal instead of the float one
+	int checksum; // consumes the results so the casts are not optimized away
+} ray_bench, *ray_bench_ptr;
+
+void Benchmark_Rays(void *data)
+{
+	// cast a full field of view from the start position in eight directions
+
+	ray_bench_ptr bench = (ray_bench_ptr)data;
+	ray_hit hit;
+
+	for (int view_angle = ANGLE_0; view_angle < ANGLE_360; view_angle += ANGLE_45) {
+		for (int ray = 0; ray < bench->rays; ray++) {
+			int ray_angle = (view_angle - ANGLE_30 + ray * ANGLE_60 / bench->rays + ANGLE_360) % ANGLE_360;
+			if (bench->use_fixed) {
+				Raycast_Cast(53 * 64 + 25, 14 * 64 + 25, view_angle, ray_angle, &hit);
+			} else {
+				Ray_Cast_Float(53 * 64 + 25, 14 * 64 + 25, ray_angle, &hit);
+			}
+			bench->checksum += hit.column + hit.distance;
+		}
+	}
+}
+
+void Benchmark_View_Serial(void *data)
+{
+	// the same work as Ray_Caster without the worker pool
+	view_ptr eye = (view_ptr)data;
+
+	for (int ray = 0; ray < 320; ray++) {
+		Ray_Column(ray, data);
+	}
+
+	RETRO_Damage(319, 0, 639, WINDOW_HEIGHT);
+
+	for (int ray = 319; ray >= 0; ray--) {
+		sline(eye->x, eye->y, (long)ray_hits[ray].hit_x, (long)ray_hits[ray].hit_y, 1);
+	}
+}
+
+void Benchmark_View(void *data)
+{
+	view_ptr eye = (view_ptr)data;
+	Ray_Caster(eye->x, eye->y, eye->view_angle);
+}
+
+typedef struct sliver_bench_typ
+{
+	unsigned char *frames[9]; // wall textures in the layout being measured
+	int transposed;           // frames are stored column by column
+} sliver_bench, *sliver_bench_ptr;
+
+void Benchmark_Slivers(void *data)
+{
+	// render a view worth of slivers from every wall texture at every height
+	// the window allows, reading the texels through the scale tables
+
+	sliver_bench_ptr bench = (sliver_bench_ptr)data;
+
+	for (int ray = 0; ray < 320; ray++) {
+		int scale = 8 + ray * (WINDOW_HEIGHT - 10) / 320;
+		int column = (ray * 7) & 63;
+		unsigned char *row = scale_arena + scale_table[scale];
+		unsigned char *texture = bench->frames[1 + (ray & 7)];
+		int offset = 638 - ray;
+
+		if (bench->transposed) {
+			unsigned char *texel = texture + column * SPRITE_HEIGHT;
+			for (int i = 0; i < scale; i++) {
+				RETRO.framebuffer[offset] = texel[row[i]];
+				offset += SCREEN_WIDTH;
+			}
+		} else {
+			for (int i = 0; i < scale; i++) {
+				RETRO.framebuffer[offset] = texture[row[i] * SPRITE_WIDTH + column];
+				offset += SCREEN_WIDTH;
+			}
+		}
+	}
+}
+
+long Benchmark_Sliver_Lines(sliver_bench_ptr bench)
+{
+	// count the distinct 64 byte cache lines each sliver of Benchmark_Slivers reads
+
+	long lines = 0;
+
+	for (int ray = 0; ray < 320; ray++) {
+		int scale = 8 + ray * (WINDOW_HEIGHT - 10) / 320;
+		int column = (ray * 7) & 63;
+		unsigned char *row = scale_arena + scale_table[scale];
+		unsigned char *texture = bench->frames[1 + (ray & 7)];
+		uintptr_t last = 0;
+
+		for (int i = 0; i < scale; i++) {
+			uintptr_t address = (uintptr_t)(bench->transposed ? &texture[column * SPRITE_HEIGHT + row[i]] : &texture[row[i] * SPRITE_WIDTH + column]);
+			if (i == 0 || (address >> 6) != last) {
+				last = address >> 6;
+				lines++;
+			}
+		}
+	}
+
+	return lines;
+}
+
+void Benchmark_Sprites(void *data)
+{
+	// draw a sprite on a grid of 40 places that covers most of the screen
+
+	sprite_ptr ghost = (sprite_ptr)data;
+
+	for (int y = 0; y < 5; y++) {
+		for (int x = 0; x < 8; x++) {
+			ghost->x = 8 + x * 78;
+			ghost->y = 8 + y * 78;
+			Draw_Sprite(ghost);
+		}
+	}
+}
+
+#define BENCH_SPRITES 2000
+
+typedef struct sprite_bench_typ
+{
+	sprite_ptr ghost;               // sprite with a sparse encoded frame and an opaque one
+	int x[BENCH_SPRITES];           // where each copy goes
+	int y[BENCH_SPRITES];
+	int frame[BENCH_SPRITES];
+	sprite_batch batch;
+} sprite_bench, *sprite_bench_ptr;
+
+void Benchmark_Sprites_Immediate(void *data)
+{
+	sprite_bench_ptr bench = (sprite_bench_ptr)data;
+
+	for (int index = 0; index < BENCH_SPRITES; index++) {
+		bench->ghost->x = bench->x[index];
+		bench->ghost->y = bench->y[index];
+		bench->ghost->curr_frame = bench->frame[index];
+		Draw_Sprite(bench->ghost);
+	}
+}
+
+void Benchmark_Sprites_Batch(void *data)
+{
+	sprite_bench_ptr bench = (sprite_bench_ptr)data;
+
+	Sprite_Batch_Begin(&bench->batch);
+	for (int index = 0; index < BENCH_SPRITES; index++) {
+		bench->ghost->x = bench->x[index];
+		bench->ghost->y = bench->y[index];
+		bench->ghost->curr_frame = bench->frame[index];
+		Sprite_Batch_Add(&bench->batch, bench->ghost, index & 3);
+	}
+	Sprite_Batch_Draw(&bench->batch);
+}
+
+void Benchmark_Overlay(void *data)
+{
+	// scale the control panel over the whole screen like DEMO_Render does
+
+	RECT src_rect = { 0, 0, controls_pcx.header.horz_res, controls_pcx.header.vert_res },
+	dest_rect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+	Blit_Rect(src_rect, controls_pcx.buffer, controls_pcx.header.horz_res, dest_rect, RETRO.framebuffer, SCREEN_WIDTH, *(int *)data);
+}
+
+void Benchmark_Overlay_Layer(void *data)
+{
+	RETRO_DrawLayer((RETRO_Layer *)data, controls_pcx.buffer, controls_pcx.header.horz_res, controls_pcx.header.vert_res, controls_pcx.header.horz_res, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+}
+
+typedef struct billboard_bench_typ
+{
+	raycast_view view;        // the view and depth buffer to draw into
+	sprite_ptr list[64];      // the billboards
+	int count;
+} billboard_bench, *billboard_bench_ptr;
+
+void Benchmark_Billboards(void *data)
+{
+	billboard_bench_ptr bench = (billboard_bench_ptr)data;
+	Raycast_Draw_Sprites(&bench->view, bench->list, bench->count);
+}
+
+void DEMO_Benchmark(void)
+{
+	ray_bench bench = { 0, 0, 0 };
+	char name[64];
+
+	for (bench.rays = 320; bench.rays <= 640; bench.rays *= 2) {
+		bench.use_fixed = 0;
+		snprintf(name, 64, "ray caster float %d rays", bench.rays);
+		double baseline = RETRO_Benchmark(name, Benchmark_Rays, &bench, 200);
+
+		bench.use_fixed = 1;
+		snprintf(name, 64, "ray caster fixed %d rays", bench.rays);
+		RETRO_Benchmark(name, Benchmark_Rays, &bench, 200, baseline);
+	}
+
+	// cast and render the whole view, first on this thread and then on the pool
+	view eye = { 53 * 64 + 25, 14 * 64 + 25, ANGLE_60 };
+	double serial = RETRO_Benchmark("ray caster view serial", Benchmark_View_Serial, &eye, 200);
+	RETRO_Benchmark("ray caster view parallel", Benchmark_View, &eye, 200, serial);
+
+	// render slivers from row-major copies of the walls and from the transposed originals
+	unsigned char rows[9][SPRITE_WIDTH * SPRITE_HEIGHT];
+	sliver_bench slivers;
+
+	for (int frame = 0; frame < 9; frame++) {
+		for (int y = 0; y < SPRITE_HEIGHT; y++) {
+			for (int x = 0; x < SPRITE_WIDTH; x++) {
+				rows[frame][y * SPRITE_WIDTH + x] = object.frames[frame][x * SPRITE_HEIGHT + y];
+			}
+		}
+		slivers.frames[frame] = rows[frame];
+	}
+	slivers.transposed = 0;
+	long lines = Benchmark_Sliver_Lines(&slivers);
+	double baseline = RETRO_Benchmark("sliver row-major", Benchmark_Slivers, &slivers, 1000);
+
+	for (int frame = 0; frame < 9; frame++) {
+		slivers.frames[frame] = object.frames[frame];
+	}
+	slivers.transposed = 1;
+	RETRO_Benchmark("sliver transposed", Benchmark_Slivers, &slivers, 1000, baseline);
+
+	printf("%-32s %10ld -> %ld\n", "sliver texture cache lines", lines, Benchmark_Sliver_Lines(&slivers));
+
+	int keyed = 0, opaque = -1;
+	baseline = RETRO_Benchmark("overlay keyed", Benchmark_Overlay, &keyed, 200);
+	RETRO_Benchmark("overlay opaque", Benchmark_Overlay, &opaque, 200);
+	RETRO_Layer overlay = {};
+	RETRO_Benchmark("overlay layer", Benchmark_Overlay_Layer, &overlay, 200, baseline);
+	RETRO_FreeLayer(&overlay);
+
+	// a sparse sprite, a disc of wall texture, drawn by the compiled blitter and
+	// from runs, then an opaque wall frame
+	sprite ghost;
+	Sprite_Init(&ghost, 0, 0, 0, 0, 0, 0);
+	ghost.frames[0] = (unsigned char *)malloc(SPRITE_WIDTH * SPRITE_HEIGHT);
+	for (int y = 0; y < SPRITE_HEIGHT; y++) {
+		for (int x = 0; x < SPRITE_WIDTH; x++) {
+			int dx = x - SPRITE_WIDTH / 2, dy = y - SPRITE_HEIGHT / 2;
+			ghost.frames[0][y * SPRITE_WIDTH + x] = dx * dx + dy * dy < 20 * 20 ? object.frames[1][y * SPRITE_WIDTH + x] | 1 : 0;
+		}
+	}
+	baseline = RETRO_Benchmark("sprites 40 transparent", Benchmark_Sprites, &ghost, 1000);
+	Sprite_Encode(&ghost);
+	RETRO_Benchmark("sprites 40 spans", Benchmark_Sprites, &ghost, 1000, baseline);
+	ghost.frames[1] = (unsigned char *)malloc(SPRITE_WIDTH * SPRITE_HEIGHT);
+	memcpy(ghost.frames[1], object.frames[1], SPRITE_WIDTH * SPRITE_HEIGHT);
+	ghost.blitters[1] = Sprite_Select_Blitter(ghost.frames[1]);
+	ghost.curr_frame = 1;
+	RETRO_Benchmark("sprites 40 opaque", Benchmark_Sprites, &ghost, 1000, baseline);
+
+	// a crowd of sprites, one call each and then through a batch
+	sprite_bench_ptr crowd = (sprite_bench_ptr)malloc(sizeof(sprite_bench));
+	crowd->ghost = &ghost;
+	srand(1);
+	for (int index = 0; index < BENCH_SPRITES; index++) {
+		crowd->x[index] = rand() % (SCREEN_WIDTH - SPRITE_WIDTH);
+		crowd->y[index] = rand() % (SCREEN_HEIGHT - SPRITE_HEIGHT);
+		crowd->frame[index] = index % 8 == 0;
+	}
+	snprintf(name, 64, "sprites %d immediate", BENCH_SPRITES);
+	baseline = RETRO_Benchmark(name, Benchmark_Sprites_Immediate, crowd, 50);
+	snprintf(name, 64, "sprites %d batch", BENCH_SPRITES);
+	RETRO_Benchmark(name, Benchmark_Sprites_Batch, crowd, 50, baseline);
+	free(crowd);
+	Sprite_Delete(&ghost);
+
+	// look down the long corridor south of the start and put a billboard in
+	// every other open cell, some of them hidden behind the walls
+	view corridor = { 42 * 64 + 32, 10 * 64 + 32, ANGLE_0 };
+	sprite things[64];
+	billboard_bench billboards = { { (int)corridor.x, (int)corridor.y, (int)corridor.view_angle, 319, 320, 160, 1, 0, WINDOW_HEIGHT, WINDOW_MIDDLE, VERTICAL_SCALE, ray_depth }, { NULL }, 0 };
+
+	Ray_Caster(corridor.x, corridor.y, corridor.view_angle);
+
+	for (int row = 6; row < 14; row++) {
+		for (int column = 44; column < 62; column += 2) {
+			if (world[row][column] == 0 && billboards.count < 64) {
+				sprite_ptr thing = &things[billboards.count];
+				memset(thing, 0, sizeof(sprite));
+				thing->x = column * CELL_X_SIZE + CELL_X_SIZE / 2;
+				thing->y = row * CELL_Y_SIZE + CELL_Y_SIZE / 2;
+				thing->state = SPRITE_ALIVE;
+				thing->frames[0] = object.frames[1 + billboards.count % 8];
+				billboards.list[billboards.count++] = thing;
+			}
+		}
+	}
+
+	// once with every column open and once occluded by the walls of the view
+	int open[320];
+	for (int column = 0; column < 320; column++) {
+		open[column] = RAYCAST_MAX_DELTA;
+	}
+	billboards.view.depth = open;
+	snprintf(name, 64, "billboards %d without walls", billboards.count);
+	double all = RETRO_Benchmark(name, Benchmark_Billboards, &billboards, 1000);
+	billboards.view.depth = ray_depth;
+	snprintf(name, 64, "billboards %d behind walls", billboards.count);
+	RETRO_Benchmark(name, Benchmark_Billboards, &billboards, 1000, all);
 }
 
 void DEMO_Deinitialize(void)
 {
+	free(scale_arena);
+	RETRO_FreeLayer(&controls_layer);
+
 #if MAKING_DEMO
 	// save the digitized demo data to a file
 	fp = fopen("demo.dat", "wb");
@@ -9,7 +9,18 @@
 #include "lib/retromain.h"
 #include "lib/retrogfx.h"
 #include "lib/retrofont.h"
+#include "lib/retrothread.h"
 #include "graphics.h"
+#include "raycast.h"
+
+// S T R U C T U R E S //////////////////////////////////////////////////////
+
+// this structure holds the eye position the rays are cast from
+typedef struct view_typ
+{
+	long x, y;       // position of the viewer
+	long view_angle; // direction the viewer is facing
+} view, *view_ptr;
 
 // D E F I N E S /////////////////////////////////////////////////////////////
 
@@ -26,11 +37,11 @@
 #define START_DOOR_DESTROY   1     // telsl the door engine to begin
 
 #define OVERBOARD              25  // the closest a player can get to a wall
-#define INTERSECTION_FOUND      1  // used by ray caster to flag an intersection
 #define MAX_SCALE             SCREEN_HEIGHT * 2  // maximum size and wall "sliver" can be
 #define WINDOW_HEIGHT         SCREEN_HEIGHT * 2 // height of the game view window
 #define WINDOW_MIDDLE         (SCREEN_HEIGHT / 2)  // the center or horizon of the view window
 #define VERTICAL_SCALE      15000 // used to scale the "slivers" to get proper perspective and aspect ratio
+#define SLIVER_FP              29  // fractional bits of the sliver texture steps
 
 // constants used to represent angles for the ray caster
 
@@ -71,34 +82,21 @@
 
 unsigned char world[WORLD_ROWS][WORLD_COLUMNS + 1];       // pointer to matrix of cells that make up world
 
-float tan_table[ANGLE_360 + 1];              // tangent tables used to compute initial
-float inv_tan_table[ANGLE_360 + 1];          // intersections with ray
-
-float y_step[ANGLE_360 + 1];                 // x and y steps, used to find intersections
-float x_step[ANGLE_360 + 1];                 // after initial one is found
-
-float inv_cos_table[ANGLE_360 + 1];          // used to compute distances by calculating
-float inv_sin_table[ANGLE_360 + 1];          // the hypontenuse
-
 sprite object;                     // general sprite object used by everyone
 
 pcx_picture walls_pcx;             // holds the wall textures
 
-// parmeter block used by assembly language sliver engine
+long long sliver_step[MAX_SCALE + 1]; // texture rows per screen row for each sliver height
 
-unsigned char *sliver_texture; // pointer to texture being rendered
-int sliver_column;        // index into texture i.e. which column of texture
-int sliver_top;           // starting Y position to render at
-int sliver_scale;         // overall height of sliver
-int sliver_ray;           // current ray being cast
-int sliver_clip;          // index into texture after clipping
-int *scale_row;           // row of scale value look up table to use
+int ray_depth[320];                   // perpendicular wall distance of each column, 16.16
 
 // the player
 int player_x,                 // the players X position
 player_y,                 // the players Y position
 player_view_angle;        // the current view angle of the player
 
+view player_last;         // the view before the last update, frames are drawn in between
+
 // used for color FX
 RGB_color red_glow;                       // red glowing objects
 int red_glow_index = 254;                 // index of color register to glow
@@ -113,31 +111,13 @@ void Build_Tables(void)
 {
 	// this function builds all the look up tables for the system
 
-	// create tables, sit back for a sec!
-	for (int ang = ANGLE_0; ang <= ANGLE_360; ang++) {
-		float rad_angle = (float)((3.272e-4) + ang * 2 * M_PI / ANGLE_360);
-		tan_table[ang] = (float)tan(rad_angle);
-		inv_tan_table[ang] = (float)(1 / tan_table[ang]);
-
-		// tangent has the incorrect signs in all quadrants except 1, so
-		// manually fix the signs of each quadrant since the tangent is
-		// equivalent to the slope of a line and if the tangent is wrong
-		// then the ray that is case will be wrong
-
-		if (ang >= ANGLE_0 && ang < ANGLE_180) {
-			y_step[ang] = (float)(fabs(tan_table[ang] * CELL_Y_SIZE));
-		} else
-			y_step[ang] = (float)(-fabs(tan_table[ang] * CELL_Y_SIZE));
-
-		if (ang >= ANGLE_90 && ang < ANGLE_270) {
-			x_step[ang] = (float)(-fabs(inv_tan_table[ang] * CELL_X_SIZE));
-		} else {
-			x_step[ang] = (float)(fabs(inv_tan_table[ang] * CELL_X_SIZE));
-		}
+	Raycast_Init(&world[0][0], WORLD_COLUMNS + 1, WORLD_COLUMNS, WORLD_ROWS);
 
-		// create the sin and cosine tables to copute distances
-		inv_cos_table[ang] = (float)(1 / cos(rad_angle));
-		inv_sin_table[ang] = (float)(1 / sin(rad_angle));
+	// build the sliver steps.  a float quotient has at most 24 significant
+	// bits, so 64 / (float)scale is exact in fixed point and stepping with it
+	// samples the same texels as (int)(64 / (float)scale * (y + 0.5))
+	for (int scale = 1; scale <= MAX_SCALE; scale++) {
+		sliver_step[scale] = (long long)ldexp(CELL_Y_SIZE / (float)scale, SLIVER_FP);
 	}
 }
 
@@ -180,357 +160,101 @@ int Load_World(const char *file)
 
 /////////////////////////////////////////////////////////////////////////////
 
-void Ray_Caster(long x, long y, long view_angle)
+void Render_Sliver(unsigned char *texels, int x, int top, int scale)
 {
-	// This is the heart of the system.  it casts out 320 rays and builds the
-	// 3-D image from their intersections with the walls.  It was derived from
-	// the previous version used in "RAY.C", however, it has been extremely
-	// optimized for speed by the use of many more lookup tables and fixed
-	// point math
-
-	int
-		cell_x,       // the current cell that the ray is in
-		cell_y,
-		ray,          // the current ray being cast 0-320
-		casting = 2,    // tracks the progress of the X and Y component of the ray
-		x_hit_type,   // records the block that was intersected, used to figure
-		y_hit_type,   // out which texture to use
-		x_bound,      // the next vertical and horizontal intersection point
-		y_bound,
-		next_y_cell,  // used to figure out the quadrant of the ray
-		next_x_cell,
-		xray = 0,       // tracks the progress of a ray looking for Y interesctions
-		yray = 0,       // tracks the progress of a ray looking for X interesctions
-		x_delta,      // the amount needed to move to get to the next cell
-		y_delta;      // position
-
-	float xi,     // used to track the x and y intersections
-		yi,
-		xi_save,      // used to save exact x and y intersection points
-		yi_save,
-		dist_x,  // the distance of the x and y ray intersections from
-		dist_y,  // the viewpoint
-		scale;
-
-	// S E C T I O N  1 /////////////////////////////////////////////////////////v
-
-	// initialization
-
-	// compute starting angle from player.  Field of view is 60 degrees, so
-	// subtract half of that current view angle
-
-	if ((view_angle -= ANGLE_30) < 0) {
-		view_angle = ANGLE_360 + view_angle;
-	}
-
-	// loop through all 320 rays
-
-	for (ray = 319; ray >= 0; ray--) {
-
-		// S E C T I O N  2 /////////////////////////////////////////////////////////
-
-		// compute first x intersection
-
-		// need to know which half plane we are casting from relative to Y axis
-
-		if (view_angle >= ANGLE_0 && view_angle < ANGLE_180) {
-
-			// compute first horizontal line that could be intersected with ray
-			// note: it will be above player
-
-			y_bound = CELL_Y_SIZE + CELL_Y_SIZE * (y / CELL_Y_SIZE);
-
-			// compute delta to get to next horizontal line
-
-			y_delta = CELL_Y_SIZE;
-
-			// based on first possible horizontal intersection line, compute X
-			// intercept, so that casting can begin
-
-			xi = inv_tan_table[view_angle] * (y_bound - y) + x;
-
-			// set cell delta
-
-			next_y_cell = 0;
-
-		} // end if upper half plane
-		else {
-			// compute first horizontal line that could be intersected with ray
-			// note: it will be below player
-
-			y_bound = CELL_Y_SIZE * (y / CELL_Y_SIZE);
-
-			// compute delta to get to next horizontal line
-
-			y_delta = -CELL_Y_SIZE;
-
-			// based on first possible horizontal intersection line, compute X
-			// intercept, so that casting can begin
-
-			xi = inv_tan_table[view_angle] * (y_bound - y) + x;
-
-			// set cell delta
-
-			next_y_cell = -1;
-
-		} // end else lower half plane
-
-		// S E C T I O N  3 /////////////////////////////////////////////////////////
-
-		// compute first y intersection
-
-		// need to know which half plane we are casting from relative to X axis
-
-		if (view_angle < ANGLE_90 || view_angle >= ANGLE_270) {
-
-			// compute first vertical line that could be intersected with ray
-			// note: it will be to the right of player
-
-			x_bound = CELL_X_SIZE + CELL_X_SIZE * (x / CELL_X_SIZE);
-
-			// compute delta to get to next vertical line
-
-			x_delta = CELL_X_SIZE;
-
-			// based on first possible vertical intersection line, compute Y
-			// intercept, so that casting can begin
-
-			yi = tan_table[view_angle] * (x_bound - x) + y;
-
-			// set cell delta
-
-			next_x_cell = 0;
-
-		} // end if right half plane
-		else {
-
-			// compute first vertical line that could be intersected with ray
-			// note: it will be to the left of player
-
-			x_bound = CELL_X_SIZE * (x / CELL_X_SIZE);
-
-			// compute delta to get to next vertical line
-
-			x_delta = -CELL_X_SIZE;
-
-			// based on first possible vertical intersection line, compute Y
-			// intercept, so that casting can begin
-
-			yi = tan_table[view_angle] * (x_bound - x) + y;
-
-			// set cell delta
-
-			next_x_cell = -1;
-
-		} // end else right half plane
-
-		// begin cast
-
-		casting = 2;                // two rays to cast simultaneously
-		xray = yray = 0;                // reset intersection flags
-
-		// S E C T I O N  4 /////////////////////////////////////////////////////////
-
-		while (casting) {
-
-			// continue casting each ray in parallel
-
-			if (xray != INTERSECTION_FOUND) {
-
-				// compute current map position to inspect
-
-				cell_x = ((x_bound + next_x_cell) / CELL_X_SIZE);
-				cell_y = (long)(yi / CELL_Y_SIZE);
-
-				// Make sure values are within bounds
-
-				bool oob = false;
-				if (cell_x < 0 || cell_x > WORLD_COLUMNS || cell_y < 0 || cell_y > WORLD_ROWS) {
-					oob = true;
-				}
+	// this function scales one texture column to a sliver of the given height.
+	// the sliver is clipped against the screen up front, so the inner loop is
+	// just a texel fetch and a fixed point step
 
-				// test if there is a block where the current x ray is intersecting
-
-				if (oob || (x_hit_type = world[cell_y][cell_x]) != 0) {
-					// compute distance
-
-					dist_x = (yi - y) * inv_sin_table[view_angle];
-					yi_save = yi;
-
-					// terminate X casting
-
-					xray = INTERSECTION_FOUND;
-					casting--;
-
-				} // end if a hit
-				else {
-
-					// compute next Y intercept
-
-					yi += y_step[view_angle];
-
-					// find next possible x intercept point
-
-					x_bound += x_delta;
-
-				} // end else
-
-			} // end if x ray has intersected
-
-			// S E C T I O N  5 /////////////////////////////////////////////////////////
-
-			if (yray != INTERSECTION_FOUND) {
-
-				// compute current map position to inspect
-
-				cell_x = (long)(xi / CELL_X_SIZE);
-				cell_y = ((y_bound + next_y_cell) / CELL_Y_SIZE);
-
-				// Make sure values are within bounds
-
-				bool oob = false;
-				if (cell_x < 0 || cell_x > WORLD_COLUMNS || cell_y < 0 || cell_y > WORLD_ROWS) {
-					oob = true;
-				}
-
-				// test if there is a block where the current y ray is intersecting
-
-				if (oob || (y_hit_type = world[cell_y][cell_x]) != 0) {
-
-					// compute distance
-
-					dist_y = (xi - x) * inv_cos_table[view_angle];
-					xi_save = xi;
-
-					yray = INTERSECTION_FOUND;
-					casting--;
-
-				} // end if a hit
-				else {
-
-					// terminate Y casting
-
-					xi += x_step[view_angle];
-
-					// compute next possible y intercept
-
-					y_bound += y_delta;
-
-				} // end else
-
-			} // end if y ray has intersected
-
-		} // end while not done
-
-		// S E C T I O N  6 /////////////////////////////////////////////////////////
-
-		// at this point, we know that the ray has succesfully hit both a
-		// vertical wall and a horizontal wall, so we need to see which one
-		// was closer and then render it
-
-		if (dist_x < dist_y) {
-
-			// there was a vertical wall closer than the horizontal
-
-			// compute actual scale and multiply by view filter so that spherical
-			// distortion is cancelled
+	if (scale <= 0) {
+		return;
+	}
 
-			float cos_ray = 1 / cos((ray - ANGLE_30) * 2 * M_PI / ANGLE_360);
-			scale = cos_ray * VERTICAL_SCALE / (1e-10 + dist_x);
+	// skip the rows above the screen and stop at the bottom of it
+	int sliver_clip = top < 0 ? -top : 0;
+	int bottom = SDL_min(scale, SCREEN_HEIGHT - top);
 
-			// clip wall sliver against view port
+	// the texel for row y is at (y + 0.5) steps, start at the first visible row
+	long long step = sliver_step[scale];
+	long long index = (step >> 1) + sliver_clip * step;
 
-			if (scale > (MAX_SCALE - 1)) {
-				scale = (MAX_SCALE - 1);
-			}
+	unsigned char *dest = &RETRO.framebuffer[(top + sliver_clip) * SCREEN_WIDTH + x];
 
-			if (scale > (WINDOW_HEIGHT - 1)) {
-				scale = (WINDOW_HEIGHT - 1);
-			}
+	for (int y = sliver_clip; y < bottom; y++) {
+		*dest = texels[index >> SLIVER_FP];
+		dest += SCREEN_WIDTH;
+		index += step;
+	}
+}
 
-			sliver_scale = scale - 1;
+/////////////////////////////////////////////////////////////////////////////
 
-			// set up parameters for assembly language
-			// sliver_texture  ; a pointer to the texture memory
-			// sliver_column   ; the current texture column
-			// sliver_top      ; the starting Y of the sliver
-			// sliver_scale    ; the over all height of the sliver
-			// sliver_ray      ; the current video column
-			// sliver_clip     ; how much of the texture is being clipped
+void Ray_Column(int ray, void *data)
+{
+	// casts and renders a single ray.  this runs on the worker threads, so it
+	// must only write its own video column
 
-			sliver_texture = object.frames[x_hit_type];
-			sliver_column = ((int)yi_save & 63);
-			sliver_top = WINDOW_MIDDLE - ((int)scale >> 1);
-			sliver_ray = ray;
+	view_ptr eye = (view_ptr)data;
+	ray_hit hit;      // the cell, side and distance the ray stopped at
 
-			// render the sliver
-			for (int y = 0; y < sliver_scale; y++) {
-				int work_offset = (int)((CELL_Y_SIZE / (float)sliver_scale * (y + 0.5))) * CELL_X_SIZE;
-				if (y + sliver_top >= 0 && y + sliver_top < SCREEN_HEIGHT && sliver_ray >= 0 && sliver_ray < SCREEN_WIDTH) {
-					RETRO.framebuffer[(y + sliver_top) * SCREEN_WIDTH + sliver_ray] = sliver_texture[work_offset + sliver_column];
-				}
-			}
+	int texture,      // the wall texture to use
+		scale,
+		sliver_scale; // overall height of sliver
 
-		} // end if
+	// rays are cast from right to left, starting half the field of view
+	// (30 degrees) before the view angle
 
-		else // must of hit a horizontal wall first
-		{
-			// there was a vertical wall closer than the horizontal
+	int ray_angle = (eye->view_angle - ANGLE_30 + (319 - ray) + ANGLE_360) % ANGLE_360;
 
-			// compute actual scale and multiply by view filter so that spherical
-			// distortion is cancelled
+	// walk the ray through the grid until it hits a wall, the fixed point
+	// traversal returns the perpendicular distance so there is no fishbowl
 
-			float cos_ray = 1 / cos((ray - ANGLE_30) * 2 * M_PI / ANGLE_360);
-			scale = cos_ray * VERTICAL_SCALE / (1e-10 + dist_y);
+	Raycast_Cast(eye->x, eye->y, eye->view_angle, ray_angle, &hit);
 
-			// do clipping again
+	// remember how far the wall is for the sprites
+	ray_depth[ray] = hit.perp;
 
-			if (scale > (MAX_SCALE - 1)) {
-				scale = (MAX_SCALE - 1);
-			}
+	// vertical walls use the even textures, horizontal walls the odd ones
 
-			if (scale > (WINDOW_HEIGHT - 1)) {
-				scale = (WINDOW_HEIGHT - 1);
-			}
+	texture = (hit.side == RAYCAST_SIDE_X) ? hit.hit_type : hit.hit_type + 1;
 
-			sliver_scale = scale - 1;
+	// compute actual scale from the perpendicular distance
 
-			// set up parameters for assembly language
-			// sliver_texture  ; a pointer to the texture memory
-			// sliver_column   ; the current texture column
-			// sliver_top      ; the starting Y of the sliver
-			// sliver_scale    ; the over all height of the sliver
-			// sliver_ray      ; the current video column
-			// sliver_clip     ; how much of the texture is being clipped
+	scale = (int)(((long long)VERTICAL_SCALE << RAYCAST_FP) / hit.perp);
 
-			sliver_texture = object.frames[y_hit_type + 1];
-			sliver_column = ((int)xi_save & 63);
-			sliver_top = WINDOW_MIDDLE - ((int)scale >> 1);
-			sliver_ray = ray;
+	// clip wall sliver against view port
 
-			// render the sliver
-			for (int y = 0; y < sliver_scale; y++) {
-				int work_offset = (int)((CELL_Y_SIZE / (float)sliver_scale * (y + 0.5))) * CELL_X_SIZE;
-				if (y + sliver_top >= 0 && y + sliver_top < SCREEN_HEIGHT && sliver_ray >= 0 && sliver_ray < SCREEN_WIDTH) {
-					RETRO.framebuffer[(y + sliver_top) * SCREEN_WIDTH + sliver_ray] = sliver_texture[work_offset + sliver_column];
-				}
-			}
+	if (scale > (MAX_SCALE - 1)) {
+		scale = (MAX_SCALE - 1);
+	}
 
-		} // end else
+	if (scale > (WINDOW_HEIGHT - 1)) {
+		scale = (WINDOW_HEIGHT - 1);
+	}
 
-		// S E C T I O N  7 /////////////////////////////////////////////////////////
+	sliver_scale = scale - 1;
 
-		// cast next ray
+	// textures are stored transposed, so the column is a contiguous run of texels
+	Render_Sliver(object.frames[texture] + hit.column * SPRITE_HEIGHT, ray, WINDOW_MIDDLE - (scale >> 1), sliver_scale);
+}
 
-		// test if view angle need to wrap around
+/////////////////////////////////////////////////////////////////////////////
 
-		if (++view_angle >= ANGLE_360) {
+void Ray_Caster(long x, long y, long view_angle)
+{
+	// This is the heart of the system.  it casts out 320 rays and builds the
+	// 3-D image from their intersections with the walls.  It was derived from
+	// the previous version used in "RAY.C", however, it has been extremely
+	// optimized for speed by the use of many more lookup tables and fixed
+	// point math.  the rays are independent, so they are cast in strips of
+	// columns on the worker pool
 
-			view_angle = 0;
+	view eye = { x, y, view_angle };
 
-		} // end if
+	RETRO_ParallelFor(320, 16, Ray_Column, &eye);
 
-	} // end for ray
+	// the workers only write pixels, so mark the whole view at once
+	RETRO_Damage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
 } // end Ray_Caster
 
@@ -586,14 +310,47 @@ void Destroy_Door(int x_cell, int y_cell, int command)
 	}
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+void Interpolate_View(view_ptr eye)
+{
+	// place the eye between the last two updates, as far as the frame lies
+	// past the last one, turning the short way around the circle
+
+	long turn = player_view_angle - player_last.view_angle;
+
+	if (turn > ANGLE_180) {
+		turn -= ANGLE_360;
+	} else if (turn < -ANGLE_180) {
+		turn += ANGLE_360;
+	}
+
+	eye->x = player_last.x + lround((player_x - player_last.x) * RETRO.alpha);
+	eye->y = player_last.y + lround((player_y - player_last.y) * RETRO.alpha);
+	eye->view_angle = player_last.view_angle + lround(turn * RETRO.alpha);
+
+	if (eye->view_angle < ANGLE_0) {
+		eye->view_angle += ANGLE_360;
+	} else if (eye->view_angle > ANGLE_360) {
+		eye->view_angle -= ANGLE_360;
+	}
+}
+
 // M A I N ///////////////////////////////////////////////////////////////////
 
-void DEMO_Render(double deltatime)
+void DEMO_Update(void)
 {
+	// move the world one fixed step of 1/60 s, the player moves STEP_LENGTH
+	// and turns ANGLE_3 per step no matter how fast the frames are drawn
+
 	// reset deltas
 	float dx = 0;
 	float dy = 0;
 
+	player_last.x = player_x;
+	player_last.y = player_y;
+	player_last.view_angle = player_view_angle;
+
 	// what is user doing
 
 	if (RETRO_KeyState(SDL_SCANCODE_RIGHT)) {
@@ -687,7 +444,10 @@ void DEMO_Render(double deltatime)
 
 	// call all responder and temporal functions that occur each frame
 	Destroy_Door(0, 0, PROCESS_DOOR_DESTROY);
+}
 
+void DEMO_Render(double deltatime)
+{
 	// S E C T I O N   7 /////////////////////////////////////////////////////////
 
 	// clear the double buffer and render the ground and ceiling
@@ -695,7 +455,9 @@ void DEMO_Render(double deltatime)
 	RETRO_DrawFilledRectangle(0, RETRO_HEIGHT / 2, RETRO_WIDTH, RETRO_HEIGHT, 8);
 
 	// render the view
-	Ray_Caster(player_x, player_y, player_view_angle);
+	view eye;
+	Interpolate_View(&eye);
+	Ray_Caster(eye.x, eye.y, eye.view_angle);
 }
 
 void DEMO_Initialize(void)
@@ -732,15 +494,18 @@ void DEMO_Initialize(void)
 	// dont need textures anymore
 	PCX_Delete((pcx_picture_ptr)&walls_pcx);
 
+	// store the walls column by column for the sliver renderer
+	Sprite_Transpose((sprite_ptr)&object);
+
 	// initialize the generic sprite we will use to access the textures with
 	object.curr_frame = 0;
 	object.x = 0;
 	object.y = 0;
 
 	// position the player somewhere interseting
-	player_x = 53 * 64 + 25;
-	player_y = 14 * 64 + 25;
-	player_view_angle = ANGLE_60;
+	player_x = player_last.x = 53 * 64 + 25;
+	player_y = player_last.y = 14 * 64 + 25;
+	player_view_angle = player_last.view_angle = ANGLE_60;
 
 	red_glow.red = 0;
 	red_glow.green = 0;